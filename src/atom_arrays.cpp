@@ -0,0 +1,210 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+/* Flat (structure-of-arrays) atom data for the energy kernels.
+system.molecules is still where atoms live for I/O, MD and the dipoles; system.atoms
+holds the few per-atom numbers the pair loops need in contiguous arrays, so a kernel
+streams x/y/z/eps/sig/C instead of walking Atom objects. In MC it is built once and
+follows the moves incrementally (as do the cell list and system.atommap, whose index is
+the flat index); only a volume move, which scales every position, builds it again. MD
+moves the atoms outside it, so there every full energy or force call rebuilds it.
+*/
+
+// count flat atom a in (delta = 1) or out of (delta = -1) the per-type totals
+void atomTypesCount(System &system, int a, int delta) {
+    AtomArrays &at = system.atoms;
+    const int t = at.type[a];
+    if (t >= at.type_movable.size()) {
+        at.type_movable.resize(system.atomtypes.n, 0);
+        at.type_frozen.resize(system.atomtypes.n, 0);
+    }
+    if (at.frozen[a]) at.type_frozen[t] += delta;
+    else {
+        at.type_movable[t] += delta;
+        at.movable_C2 += delta * at.C[a] * at.C[a];
+    }
+}
+
+// copy atom j of molecule i into flat slot a
+void atomArraysSet(System &system, int a, int i, int j) {
+    Atom &atom = system.molecules[i].atoms[j];
+    if (atom.type < 0) atom.type = atomTypeId(system, atom.name, atom.eps, atom.sig); // atoms made outside the input readers
+    system.atoms.x[a] = atom.pos[0];
+    system.atoms.y[a] = atom.pos[1];
+    system.atoms.z[a] = atom.pos[2];
+    system.atoms.C[a] = atom.C;
+    system.atoms.eps[a] = atom.eps;
+    system.atoms.sig[a] = atom.sig;
+    system.atoms.polar[a] = atom.polar;
+    system.atoms.mol[a] = i;
+    system.atoms.frozen[a] = system.molecules[i].frozen;
+    system.atoms.type[a] = atom.type;
+    system.atoms.fgrid_id[a] = atom.fgrid_id;
+    system.atoms.cell[a] = -1;
+    system.atommap[a][0] = i;
+    system.atommap[a][1] = j;
+}
+
+void atomArraysResize(System &system, int n) {
+    system.atoms.x.resize(n); system.atoms.y.resize(n); system.atoms.z.resize(n);
+    system.atoms.C.resize(n); system.atoms.eps.resize(n); system.atoms.sig.resize(n); system.atoms.polar.resize(n);
+    system.atoms.mol.resize(n); system.atoms.frozen.resize(n); system.atoms.type.resize(n); system.atoms.fgrid_id.resize(n); system.atoms.cell.resize(n);
+    system.atommap.resize(n, vector<int>(2));
+}
+
+// (re)build the arrays, and the cell list on top of them, from system.molecules
+void buildAtomArrays(System &system) {
+    int i, j, a=0;
+    system.atoms.start.resize(system.molecules.size()+1);
+    for (i=0; i<system.molecules.size(); i++) {
+        system.atoms.start[i] = a;
+        a += system.molecules[i].atoms.size();
+    }
+    system.atoms.start[system.molecules.size()] = a;
+    atomArraysResize(system, a);
+
+    for (i=0; i<system.molecules.size(); i++)
+        for (j=0; j<system.molecules[i].atoms.size(); j++)
+            atomArraysSet(system, system.atoms.start[i]+j, i, j);
+
+    system.atoms.type_movable.assign(system.atomtypes.n, 0);
+    system.atoms.type_frozen.assign(system.atomtypes.n, 0);
+    system.atoms.movable_C2 = 0;
+    for (a=0; a<system.atoms.x.size(); a++)
+        atomTypesCount(system, a, 1);
+
+    buildCells(system);
+}
+
+// a molecule was appended to system.molecules
+void atomArraysAddMolecule(System &system, int molid) {
+    const int first = system.atoms.start[molid];
+    const int n = system.molecules[molid].atoms.size();
+    atomArraysResize(system, first+n);
+    system.atoms.start.push_back(first+n);
+    for (int j=0; j<n; j++) {
+        atomArraysSet(system, first+j, molid, j);
+        atomTypesCount(system, first+j, 1);
+    }
+    cellsAddMolecule(system, molid);
+}
+
+// the last molecule is about to be popped off system.molecules
+void atomArraysRemoveMolecule(System &system, int molid) {
+    cellsRemoveMolecule(system, molid);
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++)
+        atomTypesCount(system, a, -1);
+    atomArraysResize(system, system.atoms.start[molid]);
+    system.atoms.start.pop_back();
+}
+
+// flat slot a takes the data of slot b
+void atomArraysCopy(System &system, int a, int b) {
+    system.atoms.x[a] = system.atoms.x[b];
+    system.atoms.y[a] = system.atoms.y[b];
+    system.atoms.z[a] = system.atoms.z[b];
+    system.atoms.C[a] = system.atoms.C[b];
+    system.atoms.eps[a] = system.atoms.eps[b];
+    system.atoms.sig[a] = system.atoms.sig[b];
+    system.atoms.polar[a] = system.atoms.polar[b];
+    system.atoms.mol[a] = system.atoms.mol[b];
+    system.atoms.frozen[a] = system.atoms.frozen[b];
+    system.atoms.type[a] = system.atoms.type[b];
+    system.atoms.fgrid_id[a] = system.atoms.fgrid_id[b];
+    system.atoms.cell[a] = system.atoms.cell[b];
+    system.atommap[a][0] = system.atommap[b][0];
+    system.atommap[a][1] = system.atommap[b][1];
+}
+
+// molecule molid is about to be overwritten by the last molecule (same number of atoms),
+// which is then popped off system.molecules. nothing else moves
+void atomArraysReplaceWithLast(System &system, int molid) {
+    const int last = (int)system.atoms.start.size()-2;
+    const int first = system.atoms.start[molid], last_first = system.atoms.start[last];
+    cellsRemoveMolecule(system, molid);
+    cellsRemoveMolecule(system, last);
+    for (int a=first; a<system.atoms.start[molid+1]; a++)
+        atomTypesCount(system, a, -1);
+    for (int j=0; j<system.atoms.start[molid+1]-first; j++) {
+        atomArraysCopy(system, first+j, last_first+j);
+        system.atoms.mol[first+j] = molid;
+        system.atommap[first+j][0] = molid;
+    }
+    atomArraysResize(system, last_first);
+    system.atoms.start.pop_back();
+    cellsAddMolecule(system, molid);
+}
+
+// molecules i and k (same number of atoms) are about to swap places in system.molecules.
+// their flat slots trade data; the molecule indices stay with the slots
+void atomArraysSwapMolecules(System &system, int i, int k) {
+    AtomArrays &at = system.atoms;
+    const int first_i = at.start[i], first_k = at.start[k];
+    const int n = at.start[i+1] - first_i;
+    cellsRemoveMolecule(system, i);
+    cellsRemoveMolecule(system, k);
+    for (int j=0; j<n; j++) {
+        const int a = first_i+j, b = first_k+j;
+        std::swap(at.x[a], at.x[b]); std::swap(at.y[a], at.y[b]); std::swap(at.z[a], at.z[b]);
+        std::swap(at.C[a], at.C[b]); std::swap(at.eps[a], at.eps[b]); std::swap(at.sig[a], at.sig[b]); std::swap(at.polar[a], at.polar[b]);
+        std::swap(at.type[a], at.type[b]); std::swap(at.fgrid_id[a], at.fgrid_id[b]);
+    }
+    cellsAddMolecule(system, i);
+    cellsAddMolecule(system, k);
+}
+
+// molecule molid is about to be erased from system.molecules; everything after it shifts down
+void atomArraysEraseMolecule(System &system, int molid) {
+    int a;
+    const int first = system.atoms.start[molid];
+    const int n = system.atoms.start[molid+1] - first;
+    const int total = system.atoms.x.size();
+    cellsEraseMolecule(system, molid, n);
+    for (a=first; a<first+n; a++)
+        atomTypesCount(system, a, -1);
+
+    for (a=first; a<total-n; a++) {
+        atomArraysCopy(system, a, a+n);
+        system.atoms.mol[a]--;
+        system.atommap[a][0]--;
+    }
+    atomArraysResize(system, total-n);
+    for (int i=molid; i+1<system.atoms.start.size(); i++)
+        system.atoms.start[i] = system.atoms.start[i+1] - n;
+    system.atoms.start.pop_back();
+}
+
+// a molecule moved: copy its new positions and re-bin it
+void atomArraysUpdateMolecule(System &system, int molid) {
+    const int first = system.atoms.start[molid];
+    for (int j=0; j<system.molecules[molid].atoms.size(); j++) {
+        system.atoms.x[first+j] = system.molecules[molid].atoms[j].pos[0];
+        system.atoms.y[first+j] = system.molecules[molid].atoms[j].pos[1];
+        system.atoms.z[first+j] = system.molecules[molid].atoms[j].pos[2];
+    }
+    cellsUpdateMolecule(system, molid);
+}
+
+// add per-thread force buffers onto the atoms (MD forces). f holds one block of
+// 4*natoms per thread -- fx | fy | fz | V over the flat atoms -- and the blocks are
+// added in thread order so a given thread count always gives the same forces
+void addThreadForces(System &system, const vector<double> &f) {
+    const int natoms = system.atoms.x.size();
+    const int nthreads = f.size() / (4*natoms > 0 ? 4*natoms : 1);
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < system.molecules.size(); i++) {
+        for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
+            const int a = system.atoms.start[i]+j;
+            for (int t = 0; t < nthreads; t++) {
+                const double *ft = &f[t*4*natoms];
+                for (int n = 0; n < 3; n++)
+                    system.molecules[i].atoms[j].force[n] += ft[n*natoms + a];
+                system.molecules[i].atoms[j].V += ft[3*natoms + a];
+            }
+        }
+    }
+}
@@ -8,7 +8,6 @@
 
 using namespace std;
 
-
 void computeInitialValues(System &system) {
 
     // MASS OF SYSTEM
@@ -16,16 +15,13 @@ void computeInitialValues(System &system) {
     for (int i=0; i<system.proto.size(); i++)
         system.stats.movablemass[i].value = 0.0;
 	for (int c=0; c<system.molecules.size();c++) {
-        string thismolname = system.molecules[c].name;
+        const int protoid = system.molecules[c].protoid; // -1 for frozen (setupMovables())
 		for (int d=0; d<system.molecules[c].atoms.size(); d++) {
             double thismass = system.molecules[c].atoms[d].m/system.constants.cM/system.constants.NA;
 			system.stats.totalmass.value += thismass; // total mass in g
 		    if (!system.molecules[c].frozen) {
-                for (int i=0; i<system.proto.size(); i++) {
-                    if (system.proto[i].name == thismolname)
-                        system.stats.movablemass[i].value += thismass;
-                }
-
+                if (protoid >= 0)
+                    system.stats.movablemass[protoid].value += thismass;
             }
             else if (system.molecules[c].frozen)
                 system.stats.frozenmass.value += thismass;
@@ -36,10 +32,9 @@ void computeInitialValues(System &system) {
     system.constants.initial_sorbates = system.stats.count_movables;
     for (int i=0; i<system.molecules.size(); i++) {
         if (system.molecules[i].frozen) continue;
-        string thismolname = system.molecules[i].name;
-        for (int j=0; j<system.proto.size(); j++)
-            if (thismolname == system.proto[j].name)
-                system.stats.Nmov[j].value++;
+        const int protoid = system.molecules[i].protoid;
+        if (protoid >= 0)
+            system.stats.Nmov[protoid].value++;
     }
 
     for (int i=0; i<system.proto.size(); i++)
@@ -137,16 +132,13 @@ void computeAverages(System &system) {
     for (int i=0; i<system.proto.size(); i++)
         system.stats.movablemass[i].value = 0.0;
 	for (int c=0; c<system.molecules.size();c++) {
-        string thismolname = system.molecules[c].name;
+        const int protoid = system.molecules[c].protoid; // -1 for frozen (setupMovables())
 		for (int d=0; d<system.molecules[c].atoms.size(); d++) {
             double thismass = system.molecules[c].atoms[d].m/system.constants.cM/system.constants.NA;
 			system.stats.totalmass.value += thismass; // total mass in g
 		    if (!system.molecules[c].frozen) {
-                for (int i=0; i<system.proto.size(); i++) {
-                    if (system.proto[i].name == thismolname)
-                        system.stats.movablemass[i].value += thismass;
-                }
-
+                if (protoid >= 0)
+                    system.stats.movablemass[protoid].value += thismass;
             }
             else if (system.molecules[c].frozen)
                 system.stats.frozenmass.value += thismass;
@@ -157,10 +149,9 @@ void computeAverages(System &system) {
     for (int i=0; i<system.proto.size(); i++) system.stats.Nmov[i].value = 0; // initialize b4 counting.
     for (int i=0; i<system.molecules.size(); i++) {
         if (system.molecules[i].frozen) continue;
-        string thismolname = system.molecules[i].name;
-        for (int j=0; j<system.proto.size(); j++)
-            if (thismolname == system.proto[j].name)
-                system.stats.Nmov[j].value++;
+        const int protoid = system.molecules[i].protoid;
+        if (protoid >= 0)
+            system.stats.Nmov[protoid].value++;
     }
 
     for (int i=0; i<system.proto.size(); i++)
@@ -0,0 +1,181 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+/* Linked-cell list for the MC pair loops.
+The (possibly triclinic) box is cut into dim[0] x dim[1] x dim[2] cells along the
+cell vectors, each at least one cutoff wide (perpendicular width), so every pair
+within the cutoff sits in the same or a neighbouring cell. Only used when the box
+is >= 3 cutoffs wide in every direction; otherwise all pairs are visited as before.
+Members are flat atom indices into system.atoms (atom_arrays.cpp), which keeps the
+list in step with the MC moves.
+*/
+
+// cell index of a cartesian position
+int cellOfPosition(System &system, double *pos) {
+    int p, q, n[3];
+    double frac;
+    for (p=0; p<3; p++) {
+        frac = 0;
+        for (q=0; q<3; q++)
+            frac += system.pbc.reciprocal_basis[q][p]*pos[q];
+        frac -= floor(frac); // [0,1)
+        n[p] = (int)(frac*system.cells.dim[p]);
+        if (n[p] >= system.cells.dim[p]) n[p] = system.cells.dim[p]-1; // rounding at the top edge
+    }
+    return (n[0]*system.cells.dim[1] + n[1])*system.cells.dim[2] + n[2];
+}
+
+// cell of flat atom a (see atom_arrays.cpp)
+int cellOfAtom(System &system, int a) {
+    double pos[3] = {system.atoms.x[a], system.atoms.y[a], system.atoms.z[a]};
+    return cellOfPosition(system, pos);
+}
+
+void cellsAddAtom(System &system, int a) {
+    int c = cellOfAtom(system, a);
+    system.cells.members[c].push_back(a);
+    system.atoms.cell[a] = c;
+}
+
+void cellsRemoveAtom(System &system, int a) {
+    vector<int> &m = system.cells.members[system.atoms.cell[a]];
+    for (int n=0; n<m.size(); n++) {
+        if (m[n] == a) {
+            // swap with the last entry and shrink
+            m[n] = m.back();
+            m.pop_back();
+            break;
+        }
+    }
+    system.atoms.cell[a] = -1;
+}
+
+// put a (new) molecule into the cells
+void cellsAddMolecule(System &system, int molid) {
+    if (!system.cells.active) return;
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++)
+        cellsAddAtom(system, a);
+}
+
+// take a molecule out of the cells
+void cellsRemoveMolecule(System &system, int molid) {
+    if (!system.cells.active) return;
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++)
+        cellsRemoveAtom(system, a);
+}
+
+// take a molecule (of n atoms) out of the cells before it is erased;
+// the flat indices after it shift down by n, so just their entries are renumbered
+void cellsEraseMolecule(System &system, int molid, int n) {
+    if (!system.cells.active) return;
+    cellsRemoveMolecule(system, molid);
+    for (int b=system.atoms.start[molid+1]; b<system.atoms.x.size(); b++) {
+        vector<int> &m = system.cells.members[system.atoms.cell[b]];
+        for (int k=0; k<m.size(); k++)
+            if (m[k] == b) { m[k] = b-n; break; }
+    }
+}
+
+// re-bin the atoms of a molecule that moved
+void cellsUpdateMolecule(System &system, int molid) {
+    if (!system.cells.active) return;
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++) {
+        if (cellOfAtom(system, a) == system.atoms.cell[a]) continue;
+        cellsRemoveAtom(system, a);
+        cellsAddAtom(system, a);
+    }
+}
+
+// (re)build the whole list from the atom arrays. turns it off if the box is too small for it to pay off.
+void buildCells(System &system) {
+    int p, q, a, b, c, da, db, dc;
+    system.cells.active = 0;
+    system.cells.members.clear();
+    system.cells.neighbors.clear();
+    if (!system.constants.cell_list_option || system.constants.mode != "mc" || !system.constants.all_pbc) return;
+
+    for (p=0; p<3; p++) {
+        // perpendicular width of the box along cell vector p is 1/|reciprocal vector p|
+        double rlen = 0;
+        for (q=0; q<3; q++) rlen += system.pbc.reciprocal_basis[q][p]*system.pbc.reciprocal_basis[q][p];
+        system.cells.dim[p] = (int)floor(1.0/(sqrt(rlen)*system.pbc.cutoff));
+        if (system.cells.dim[p] < 3) return;
+    }
+    system.cells.active = 1;
+
+    const int ncells = system.cells.dim[0]*system.cells.dim[1]*system.cells.dim[2];
+    system.cells.members.resize(ncells);
+    system.cells.neighbors.resize(ncells);
+
+    for (a=0; a<system.cells.dim[0]; a++)
+    for (b=0; b<system.cells.dim[1]; b++)
+    for (c=0; c<system.cells.dim[2]; c++) {
+        int id = (a*system.cells.dim[1] + b)*system.cells.dim[2] + c;
+        for (da=-1; da<=1; da++)
+        for (db=-1; db<=1; db++)
+        for (dc=-1; dc<=1; dc++) {
+            int na = (a+da+system.cells.dim[0]) % system.cells.dim[0];
+            int nb = (b+db+system.cells.dim[1]) % system.cells.dim[1];
+            int nc = (c+dc+system.cells.dim[2]) % system.cells.dim[2];
+            system.cells.neighbors[id].push_back((na*system.cells.dim[1] + nb)*system.cells.dim[2] + nc);
+        }
+    }
+
+    for (a=0; a<system.atoms.x.size(); a++)
+        cellsAddAtom(system, a);
+}
+
+// list the flat atoms that flat atom a should be paired with:
+// all atoms of molecules k >= kmin, other than a's own molecule. with use_cells (and the list
+// active) only those in the 27 surrounding cells, i.e. everything within the cutoff and some more.
+void cellPartners(System &system, int a, int kmin, int_fast8_t use_cells, vector<int> &partners) {
+    int b, n, m;
+    const int i = system.atoms.mol[a];
+    partners.clear();
+    if (use_cells && system.cells.active) {
+        const vector<int> &nb = system.cells.neighbors[system.atoms.cell[a]];
+        for (n=0; n<nb.size(); n++) {
+            const vector<int> &cm = system.cells.members[nb[n]];
+            for (m=0; m<cm.size(); m++) {
+                b = cm[m];
+                if (system.atoms.mol[b] < kmin || system.atoms.mol[b] == i) continue;
+                partners.push_back(b);
+            }
+        }
+    } else {
+        const int end = system.atoms.x.size();
+        for (b=system.atoms.start[kmin]; b<end; b++) {
+            if (system.atoms.mol[b] == i) { b = system.atoms.start[i+1]-1; continue; } // skip own molecule
+            partners.push_back(b);
+        }
+    }
+}
+
+// append the flat atoms in the 27 cells around a cartesian position (list active only):
+// everything within the cutoff of it and some more
+void cellsNear(System &system, double *pos, vector<int> &atoms) {
+    const vector<int> &nb = system.cells.neighbors[cellOfPosition(system, pos)];
+    for (int n=0; n<nb.size(); n++) {
+        const vector<int> &cm = system.cells.members[nb[n]];
+        atoms.insert(atoms.end(), cm.begin(), cm.end());
+    }
+}
+
+// drop the partners of flat atom a that the pair kernels skip anyway: frozen-frozen pairs
+// (if skip_frozen) and, with the framework grid on, frozen-movable pairs
+void prunePartners(System &system, int a, int_fast8_t skip_frozen, vector<int> &partners) {
+    const int_fast8_t fa = system.atoms.frozen[a];
+    if (!(skip_frozen && fa) && !system.constants.fgrid_option) return;
+    int m = 0;
+    for (int n=0; n<partners.size(); n++) {
+        const int_fast8_t fb = system.atoms.frozen[partners[n]];
+        if (skip_frozen && fa && fb) continue;
+        if (system.constants.fgrid_option && fa != fb) continue;
+        partners[m++] = partners[n];
+    }
+    partners.resize(m);
+}
@@ -4,6 +4,8 @@
 #include <map>
 #include <vector>
 #include <stdint.h>
+#include <stdlib.h>
+#include <new>
 
 using namespace std;
 
@@ -32,6 +34,22 @@ enum {
     MD_ATOMIC,
     MD_MOLECULAR
 };
+enum { // minimum-image policy of the pair kernels (distance.cpp)
+    BOX_NONE,
+    BOX_ORTHO,
+    BOX_TRICLINIC
+};
+enum { // energy terms of a potential form, as template flags (potential.cpp)
+    TERM_LJ = 1,
+    TERM_COMMY = 2,
+    TERM_ES = 4,
+    TERM_POLAR = 8
+};
+enum { // LJ options the lj kernels are instantiated for (lj.cpp)
+    LJ_FH = 1,
+    LJ_LRC = 2,
+    LJ_REJECT = 4
+};
 
 /* the below stuff was more-or-less adopted from mpmc code */
 typedef struct _histogram {
@@ -44,6 +62,13 @@ typedef struct _histogram {
     int norm_total=0;
 } histogram_t;
 
+// tabulated framework potential for one sorbate site type (see framework_grid.cpp)
+typedef struct _fgrid {
+    double sig=0, eps=0, C=0, mass=0; // the site type this grid is for
+    int dim[3] = {0,0,0}; // points along each cell vector
+    vector<double> rd, es; // [a][b][c] flattened, c fastest
+} fgrid_t;
+
 class FilePointer {
   public:
     FilePointer();
@@ -51,18 +76,108 @@ class FilePointer {
 };
 FilePointer::FilePointer() {}
 
-// grids (for histogram)
+// grids (for histogram, and framework potential)
 class Grid {
     public:
         Grid();
 
         histogram_t *histogram;
         histogram_t *avg_histogram;
+        vector<fgrid_t> framework;
+        int efield_dim[3] = {0,0,0}; // framework static field grid (fgrid_efield): points along each cell vector
+        vector<double> efield[3]; // x, y, z components, laid out as fgrid_t
+        vector<double> erfc_table; // for the vector Ewald kernel (see simd.cpp)
 
 };
 Grid::Grid() {}
 /* end stuff for histogram */
 
+// linked-cell list for MC pair searches (see cells.cpp)
+class Cells {
+    public:
+        Cells();
+        int_fast8_t active=0; // only if the box is >= 3 cutoffs wide
+        int dim[3] = {0,0,0}; // cells along each cell vector
+        vector<vector<int>> members; // per cell: flat atom index (in AtomArrays) of each member
+        vector<vector<int>> neighbors; // per cell: the 27 cells around it (itself included)
+};
+Cells::Cells() {}
+
+// minimal allocator for cache-line (64 byte) aligned vectors
+template <typename T>
+struct AlignedAllocator {
+    typedef T value_type;
+    AlignedAllocator() {}
+    template <typename U> AlignedAllocator(const AlignedAllocator<U> &) {}
+    T * allocate(size_t n) {
+        // over-allocate and keep the original pointer just before the aligned block
+        void *raw = malloc(n*sizeof(T) + 64 + sizeof(void*));
+        if (!raw) throw std::bad_alloc();
+        uintptr_t aligned = ((uintptr_t)raw + sizeof(void*) + 63) & ~(uintptr_t)63;
+        ((void**)aligned)[-1] = raw;
+        return (T*)aligned;
+    }
+    void deallocate(T *p, size_t) { free(((void**)p)[-1]); }
+};
+template <typename T, typename U> bool operator==(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return true; }
+template <typename T, typename U> bool operator!=(const AlignedAllocator<T> &, const AlignedAllocator<U> &) { return false; }
+typedef vector<double, AlignedAllocator<double> > aligned_vector;
+typedef vector<float, AlignedAllocator<float> > aligned_float_vector;
+
+// contiguous (structure-of-arrays) copy of the per-atom data the energy kernels read (see atom_arrays.cpp).
+// atoms are stored molecule by molecule: molecule i owns flat indices start[i] .. start[i+1]-1.
+// system.molecules stays the master copy; this one follows it through the MC moves.
+class AtomArrays {
+    public:
+        AtomArrays();
+        aligned_vector x, y, z; // position, A
+        aligned_vector C, eps, sig, polar; // as in Atom
+        vector<int> mol; // molecule index
+        vector<int_fast8_t> frozen; // the molecule's frozen flag
+        vector<int> type; // atom type id (AtomTypes)
+        vector<int> fgrid_id; // framework grid site type, if used
+        vector<int> cell; // linked-cell list cell, if used
+        vector<int> start; // first flat index of each molecule; size is molecules+1
+        vector<int> partners; // scratch pair list for the single-molecule kernels, kept so MC moves don't allocate
+
+        // how many atoms of each type there are, and the movable atoms' sum of C^2, for the
+        // terms that only depend on N and V (lj lrc, lj self lrc, ewald self)
+        vector<int> type_movable, type_frozen; // atom counts per type
+        double movable_C2=0;
+};
+AtomArrays::AtomArrays() {}
+
+// atom type registry (see atomTypeId()). a type is a distinct (name, eps, sig); every Atom
+// carries its type id, so the LJ kernels look the mixed pair parameters up instead of
+// recomputing the mixing rules, and name matching is an integer compare.
+class AtomTypes {
+    public:
+        AtomTypes();
+        int n=0; // number of types
+        vector<string> names; // distinct atom names; name_id indexes this
+        vector<int> name_id; // per type
+        vector<double> eps, sig; // per type
+        // n*n Lorentz-Berthelot mixed pair tables, [type_a*n + type_b]
+        vector<double> mix_eps, mix_sig, mix_sig6, mix_sig12;
+};
+AtomTypes::AtomTypes() {}
+
+class System;
+// energy and force entry points for this run's potential form and options; each is a template
+// instantiation picked once by setupPotentialForm() (potential.cpp), so the pair loops
+// carry no runtime checks on the model, FH, LRC or auto-reject options.
+class Kernels {
+    public:
+        Kernels();
+        double (*total)(System &) = NULL; // getTotalPotential()
+        void (*molecule)(System &, int, double *, int) = NULL; // getMoleculePotential()
+        double (*move)(System &, double *, double *) = NULL; // getMovePotential()
+        void (*forces)(System &) = NULL; // the atomic forces of calculateForces()
+        double (*lj)(System &) = NULL;
+        double (*lj_molecule)(System &, int, int) = NULL;
+};
+Kernels::Kernels() {}
+
 // Constants is sort-of a misnomer for some things in this class but you get the idea.
 class Constants {
 	public:
@@ -99,6 +214,16 @@ class Constants {
         int_fast8_t draw_box_option=1; // option to draw the box for visualization in restart.pdb
         int_fast8_t rd_lrc=1; // long range corrections for LJ RD
         int_fast8_t ewald_es=1; // ewald method for electrostatic potential calculation.
+        int_fast8_t fgrid_option=0; // MC ONLY: tabulate the frozen framework's LJ/ES on grids over the unit cell
+        double fgrid_resolution=0.2; // A, approximate spacing of framework grid points
+        int_fast8_t fgrid_efield=0; // with fgrid_option and a polar model: also tabulate the framework's static (Wolf) field for the sorbate sites
+        int_fast8_t cell_list_option=1; // MC ONLY: linked-cell pair search, used when the box is >= 3 cutoffs wide
+        int_fast8_t simd_option=1; // vectorized LJ / Ewald real-space pair kernels (AVX-512 or AVX2 if compiled for it)
+        int_fast8_t fused_pairs=1; // ljpolar/ljespolar (ewald) with a stored A matrix: one sweep over the atom pairs for lj, es real space, polar field and A matrix
+        int_fast8_t fused_done=0; // the fused sweep has run for the current full energy call; its lj/es results follow
+        double fused_lj=0, fused_es_real=0;
+        int fused_contact=0;
+        int_fast8_t delta_energy_option=1; // MC ONLY: get displace/insert/remove energies from the moved molecule only; full recompute each corrtime
         int_fast8_t pdb_long=0; // on would force long coordinate/charge output
         int_fast8_t dist_within_option=0; // a function to calculate atom distances within a certain radius of origin
         string dist_within_target; // the atom to find in above option
@@ -135,7 +260,7 @@ class Constants {
         double displace_factor=2.5; // up to +- this number in A
         double insert_factor=0.5; // probability to do insert or delete (instead of displace/rotate) in uvt
 // DEPRECATED double rotate_prob=0.5; // prob to rotate instead of displace when displace/rotate is selected
-        double rotate_angle_factor=360; // 0 -> this number to rotate if rotate selected
+        double rotate_angle_factor=360; // rotation moves turn by up to +-half this many degrees, about a random axis
 		int stepsize=1; // obvi
         int finalstep; // user defined for MC
         int  mc_corrtime=1000; // default 1k cuz I used that a lot for mpmc research
@@ -165,6 +290,10 @@ class Constants {
         // Ewald (for ES)
         double ewald_alpha; // =3.5/cutoff;
         double ewald_kmax = 7;
+        vector<int> ewald_kl; // l[0..2] of each k vector in the Ewald sum
+        vector<double> ewald_prefactor; // 4pi/V exp(-k^2/4a^2)/k^2 for each k vector
+        vector<double> ewald_sf_re, ewald_sf_im; // per-k structure factors, updated by MC moves
+        vector<double> ewald_eik_re, ewald_eik_im; // scratch for coulombic_reciprocal_molecule()
 
         // Wolf (for polarization)
         //int polar_iterative=1; // turn iterative on. If off, will just do one iteration of dipole calc and get polar energy
@@ -172,14 +301,33 @@ class Constants {
         double polar_damp = 2.1304;
         double polar_gamma = 1.03;
         int polar_max_iter = 4;
-        double **A_matrix, **B_matrix, C_matrix[3][3];
-        int polar_precision=0;
+        aligned_vector A_matrix; // dipole field tensor as 3x3 blocks: block (i,j) at 9*(i*A_capacity+j), row-major inside (see thole_amatrix())
+        aligned_float_vector A_matrix_float; // the same in single precision (polar_float_matrix)
+        int A_capacity = 0; // atoms the A matrix has room for; grows geometrically, never shrinks
+        int_fast8_t polar_float_matrix = 0; // store the A matrix in float (sums stay in double): half the memory traffic per contraction
+        int_fast8_t polar_frozen_cache = 1; // keep the frozen-frozen A matrix blocks from one step to the next (rebuilt if the frozen atoms or the box change)
+        int frozen_generation = 0; // bumped whenever a frozen atom changes index, the box changes or the A matrix is reallocated
+        int amatrix_frozen_generation = -1; // frozen_generation the cached frozen-frozen blocks were made in; -1 = nothing cached
+        double **B_matrix, C_matrix[3][3];
+        int_fast8_t polar_matrix_free = 0; // make the dipole tensor blocks inside the contraction (in-cutoff pairs only) instead of storing the 3N x 3N A matrix
+        vector<int> thole_pair_start, thole_pairs; // matrix-free: in-cutoff polar partners of each atom, CSR over the atommap index
+        double polar_local_radius = 0; // A. > 0: after a single-molecule move only re-solve the dipoles within this distance of the molecule
+        int polar_local_refresh = 100; // ... and do a full solve on every this-many-th MC step
+        vector<double> polar_local_centers; // x,y,z of the moved molecule's atoms before and after the move (getMoleculePotential)
+        double polar_local_gone = 0; // sum of mu*E (+ palmo term) over the atoms of a removed molecule, in the last accepted state
+        vector<int> polar_local_region, polar_local_start, polar_local_pairs; // the sites re-solved, and their in-cutoff polar partners (CSR)
+        vector<int> polar_local_near, polar_local_partners; // scratch
+        vector<int_fast8_t> polar_local_mark; // per flat atom: already in the region (all 0 between calls)
+        double polar_precision=0; // dipole convergence in Debye; 0 = run polar_max_iter sweeps
+        int_fast8_t polar_warm_start = 1; // with polar_precision > 0, start each solve from the last accepted dipoles
         int iter_success=0; // flag for polarization iteration failure (importance for acceptance of moves!)
         int_fast8_t polar_rrms =0;
         double dipole_rrms = 0.0;
         int_fast8_t polar_gs_ranked = 1;
         int_fast8_t polar_gs = 0;
+        int_fast8_t polar_red_black = 0; // alternate even/odd half-sweeps, each split over threads (instead of the serial gauss-seidel sweep)
         int_fast8_t polar_palmo = 1;
+        int_fast8_t polar_pcg = 0; // solve for the dipoles by preconditioned conjugate gradient instead of Jacobi/Gauss-Seidel sweeps
         int_fast8_t polar_pbc = 1; // default periodic polar
         //int thole_total_atoms = 0;
 
@@ -202,8 +350,12 @@ class Pbc {
         double basis[3][3];
         double reciprocal_basis[3][3];
 		double cutoff=0.;
+        int_fast8_t cutoff_fixed=0; // cutoff given in the input (checked against max_cutoff on every volume move)
+        double max_cutoff=0; // half the narrowest perpendicular width of the cell; minimum image needs cutoff <= this
+        double shortest_vector=0; // shortest lattice vector of the cell (calcCutoff())
         double volume, inverse_volume, old_volume;
         double a, b, c, alpha, beta, gamma;
+        int box_policy=BOX_NONE; // BOX_NONE, BOX_ORTHO or BOX_TRICLINIC; set in setupBox()
         double box_vertices[8][3];
         double A[6], B[6], C[6], D[6]; // these are coefficients for plane equations for PBC
             /* structure of box_points
@@ -252,7 +404,8 @@ class Pbc {
             }
 
             // 3) calculate normal vector to the plane
-            double* normal = crossprod(vector1, vector2);
+            double normal[3];
+            crossprod(vector1, vector2, normal);
 
             // 4) plane equation is thus defined
             A[planeIndex] = normal[0];
@@ -298,14 +451,13 @@ class Pbc {
             inverse_volume = 1.0/volume;
         }
 
+        // needs calcRecip() first
         void calcCutoff() {
-            if (cutoff != 0.) return; // mpmc only changes the cutoff if it's nonzero
             double MAXVALUE = 1e40; int MAX_VECT_COEF = 5;
 			int i, j, k, p;
 			double curr_mag;
 			double short_mag = MAXVALUE;
 			double curr_vec[3];
-			if ( volume <= 0 ) cutoff = MAXVALUE;
 
             // smallest vector problem
 			for ( i=-MAX_VECT_COEF; i<=MAX_VECT_COEF; i++ ) {
@@ -323,6 +475,17 @@ class Pbc {
 				    }
 				}
 			}
+
+            shortest_vector = short_mag;
+
+            // perpendicular width along cell vector p is 1/|reciprocal vector p|
+            max_cutoff = MAXVALUE;
+            for ( p = 0; p < 3; p++ ) {
+                double rlen = sqrt(reciprocal_basis[0][p]*reciprocal_basis[0][p] + reciprocal_basis[1][p]*reciprocal_basis[1][p] + reciprocal_basis[2][p]*reciprocal_basis[2][p]);
+                if ( 0.5/rlen < max_cutoff ) max_cutoff = 0.5/rlen;
+            }
+
+            if (cutoff != 0.) return; // mpmc only changes the cutoff if it's nonzero
 			cutoff = 0.5*short_mag;
         }
 
@@ -481,6 +644,7 @@ class Stats {
         int count_frozen_molecules=0; // frozen MOLECULES; normally 1
 
         double polar_iterations=0;
+        double energy_drift=0; // (delta-tracked - full) potential at last corrtime check, K
 
         struct obs_t {
             string name;
@@ -554,6 +718,9 @@ class Last {
             frozenmass,pressure,temperature, fdotrsum, dist_within, csp, diffusion;
 
         int total_atoms, thole_total_atoms;
+        vector<double> ewald_sf_re, ewald_sf_im;
+        vector<int> polar_sites; // flat indices of the sites whose dip, efield and efield_induced_change are saved below
+        vector<double> polar_values; // 9 per site, from before the solve of this MC step overwrote them (polarSave())
 
         int max_sorbs = 10;
         vector<double> wtp = vector<double>(max_sorbs);
@@ -584,6 +751,8 @@ class Atom {
         //double E=0.0; // total energy in K
 		int PDBID; // the atom's PDBID (from input)
         double rank_metric;  // for polarization sorting
+        int type=-1; // atom type id (AtomTypes), from atomTypeId()
+        int fgrid_id=-1; // framework grid for this site type, if used
 
         double pos[3] = {0,0,0};
 		//double prevpos[3] = {0,0,0};
@@ -653,6 +822,12 @@ class Molecule {
         double ang_acc[3] = {0,0,0};
         double old_ang_acc[3] = {0,0,0};
         double ang_pos[3] = {0,0,0};
+        // rigid-body state (setupRigidBodies()): the sites are com + R(q) times the template
+        // system.bodies[body]. body is -1 for frozen and single-site molecules (and in atomic MD)
+        int body=-1;
+        double q[4] = {1,0,0,0}; // orientation, unit quaternion (w,x,y,z)
+        int protoid=-1; // system.proto this is a copy of (-1: frozen or no match)
+        int slot=-1; // position in system.movables (movable molecules only)
         //double d_theta[3] = {0,0,0};
         //vector<double> com = vector<double>(3); // center of mass for molecule. Using for MD rotations
         double mass=0.0;
@@ -678,6 +853,10 @@ class Molecule {
                 ang_pos[n]=0;
                 //d_theta[n]=0;
             }
+            body = -1;
+            q[0] = 1; q[1] = q[2] = q[3] = 0;
+            protoid = -1;
+            slot = -1;
             name = "";
             PDBID=0;
             frozen = 0; // movable
@@ -756,11 +935,12 @@ class Molecule {
             }
         }
 
-        // linear position
+        // linear position (the COM moves along, so rotations pivot about the new one)
         void calc_pos(double dt) {
             for (int i=0; i<atoms.size(); i++) {
               for (int n=0; n<3; n++) atoms[i].pos[n] = atoms[i].pos[n] + vel[n] * dt + 0.5*acc[n] * dt * dt;
             }
+            for (int n=0; n<3; n++) com[n] = com[n] + vel[n] * dt + 0.5*acc[n] * dt * dt;
         }
 
         void calc_force() {
@@ -774,6 +954,10 @@ class Molecule {
 
         void calc_center_of_mass() {
             // assigns the current center of mass of the molecule based on positions of atoms
+            if (atoms.size() == 1) { // single-site sorbate: the site is the COM (also for a massless site)
+                com[0] = atoms[0].pos[0]; com[1] = atoms[0].pos[1]; com[2] = atoms[0].pos[2];
+                return;
+            }
             double x_mass_sum=0.0; double y_mass_sum=0.0; double z_mass_sum=0.0; double mass_sum=0.0;
 
             for (int i=0; i<atoms.size(); i++) {
@@ -10,42 +10,45 @@
 double commy(System &system) {
     // the communist potential from 1961 van der Waals paper
     // http://iopscience.iop.org/article/10.1070/PU1961v004n02ABEH003330/meta;jsessionid=F9941A012802331F1E4FF488A0F004A9.c4.iopscience.cld.iop.org  
-    double total_pot=0; 
     const double cutoff = system.pbc.cutoff;
     //double volume = system.pbc.volume;
-    int i,j,k,l;
-    double r,sr6,r7;
+    const int natoms = system.atoms.x.size();
     const double numerator= system.constants.HBARC * -23.0;
     const double FourPi = 12.566370614359172;
+    vector<double> thread_pot(threadCount(), 0.0); // summed in thread order below
+
+    #pragma omp parallel
+    {
+    double total_pot=0;
+    int a,b,n; // flat atom indices
+    vector<int> partners;
+    double r,ir6,r7,d[3];
     double polar1, polar2;    
     double attractive, repulsive; // energies
     double eps,sig;
+    int k; // type pair
 
-    for (i = 0; i < system.molecules.size(); i++) {
-    for (j = 0; j < system.molecules[i].atoms.size(); j++) {
-    for (k = i+1; k < system.molecules.size(); k++) { // so if one frozen molecule, frozen-frozen is ignored.
-    for (l =0; l < system.molecules[k].atoms.size(); l++) {
+    #pragma omp for schedule(static, 16)
+    for (a = 0; a < natoms; a++) {
+    cellPartners(system, a, system.atoms.mol[a]+1, 1, partners); // so if one frozen molecule, frozen-frozen is ignored.
+    for (n = 0; n < partners.size(); n++) {
+        b = partners[n];
 
         attractive=0; repulsive=0;
 
-        // do mixing rules
-        eps = system.molecules[i].atoms[j].eps,sig=system.molecules[i].atoms[j].sig;
-        if (eps != system.molecules[k].atoms[l].eps)
-            eps = sqrt(eps * system.molecules[k].atoms[l].eps);
-        if (sig != system.molecules[k].atoms[l].sig)
-            sig = 0.5 * (sig + system.molecules[k].atoms[l].sig);
+        // mixed pair parameters, from the atom type tables
+        k = system.atoms.type[a]*system.atomtypes.n + system.atoms.type[b];
+        eps = system.atomtypes.mix_eps[k], sig = system.atomtypes.mix_sig[k];
 
-        polar1 = system.molecules[i].atoms[j].polar;
-        polar2 = system.molecules[k].atoms[l].polar;
+        polar1 = system.atoms.polar[a];
+        polar2 = system.atoms.polar[b];
 
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system, i, j, k, l);
-        r = distances[3]; //printf("r %f\n", r);
+        r = getDistanceAtoms(system, a, b, d); //printf("r %f\n", r);
         if (sig != 0 && eps != 0) {
-            sr6 = sig/r;
-            sr6 *= sr6;
-            sr6 *= sr6*sr6;
-            repulsive = 4.0*eps*(sr6*sr6);
+            ir6 = 1.0/(r*r);
+            ir6 *= ir6*ir6;
+            repulsive = 4.0*eps*system.atomtypes.mix_sig12[k]*ir6*ir6;
         }
 
         if (polar1 != 0 && polar2 != 0) {
@@ -62,10 +65,11 @@ double commy(System &system) {
             //printf("attractive: %f repulsive: %f\n", attractive, repulsive);
         }
         
-    }  // loop l
-    } // loop k 
-    } //loop j
-    } // loop i
+    }  // loop partners b
+    } // loop a
+    thread_pot[threadId()] = total_pot;
+    } // end parallel region
+    const double total_pot = sumThreads(thread_pot);
 
 
 //    printf("total commy: %e \n", total_pot);
@@ -73,5 +77,53 @@ double commy(System &system) {
 
 }
 
+// commy potential of one molecule with the rest of the system (for MC energy differences)
+double commy_molecule(System &system, int molid) {
+    double total_pot=0;
+    const double cutoff = system.pbc.cutoff;
+    int a,b,n;
+    vector<int> &partners = system.atoms.partners;
+    double r,ir6,r7,d[3];
+    const double numerator= system.constants.HBARC * -23.0;
+    const double FourPi = 12.566370614359172;
+    double polar1, polar2;
+    double attractive, repulsive; // energies
+    double eps,sig;
+    int k; // type pair
+
+    for (a = system.atoms.start[molid]; a < system.atoms.start[molid+1]; a++) {
+    cellPartners(system, a, 0, 1, partners);
+    for (n = 0; n < partners.size(); n++) {
+        b = partners[n];
+
+        attractive=0; repulsive=0;
+
+        // mixed pair parameters, from the atom type tables
+        k = system.atoms.type[a]*system.atomtypes.n + system.atoms.type[b];
+        eps = system.atomtypes.mix_eps[k], sig = system.atomtypes.mix_sig[k];
+
+        polar1 = system.atoms.polar[a];
+        polar2 = system.atoms.polar[b];
+
+        r = getDistanceAtoms(system, a, b, d);
+        if (sig != 0 && eps != 0) {
+            ir6 = 1.0/(r*r);
+            ir6 *= ir6*ir6;
+            repulsive = 4.0*eps*system.atomtypes.mix_sig12[k]*ir6*ir6;
+        }
+
+        if (polar1 != 0 && polar2 != 0) {
+            r7= r*r; // r2
+            r7 *= r7 * r7; // r6
+            r7 *= r; // r7
+            attractive = ((numerator/(FourPi*r7)) * polar1 * polar2) / 50;
+        }
+
+        if ((r <= cutoff))
+            total_pot += attractive + repulsive;
 
+    }  // loop partners b
+    } // loop a
 
+    return total_pot;
+}
@@ -33,22 +33,23 @@ fi
 
 
 if [[ "$option" == "cpu" ]]; then
-    # THIS IS FOR SERIAL COMPILATION (1 CPU ONLY, NO GPU)
-    echo "Doing serial GCC (1 processor) compilation for CPU"
+    # THIS IS FOR CPU COMPILATION (NO GPU). -fopenmp threads the full energy/force loops;
+    # set OMP_NUM_THREADS to choose how many (OMP_NUM_THREADS=1 for a serial run)
+    echo "Doing GCC (OpenMP) compilation for CPU"
     if [[ "$2" == "circe" ]]; then
         module purge
         module load compilers/gcc/6.2.0
-        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers
+        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -fopenmp -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers
     elif [[ "$2" == "bridges" ]]; then
         module purge
         module load gcc/6.3.0
-        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers
+        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -fopenmp -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers
     elif [[ "$2" == "errors" ]]; then
-        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -Ofast -Werror -Wall;
+        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -fopenmp -Ofast -Werror -Wall;
     elif [[ "$2" == "linux" ]]; then
-        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers 
+        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -fopenmp -Ofast -foptimize-sibling-calls -finline-limit=10000 -fexpensive-optimizations -flto -march=native -frename-registers 
     else
-        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -Ofast;
+        g++ main.cpp -lm -o ../mcmd -I. -std=c++11 -fopenmp -Ofast;
     fi
 
 elif [[ "$option" == "gpu" ]]; then
@@ -64,12 +65,12 @@ elif [[ "$option" == "gpu" ]]; then
     fi
 elif [[ "$option" == "icpu" ]]; then
     # CPU compilation using Intel
-    echo "Doing serial Intel (1 proc.) compilation for CPU"
+    echo "Doing Intel (OpenMP) compilation for CPU"
     if [[ "$2" == "bridges" ]]; then
         module purge
         module load icc/16.0.3
-        icpc --std=c++11 -fast -unroll-aggressive -O3 -o ../mcmd main.cpp
+        icpc --std=c++11 -qopenmp -fast -unroll-aggressive -O3 -o ../mcmd main.cpp
     else
-        icpc --std=c++11 -fast -unroll-aggressive -O3 -o ../mcmd main.cpp
+        icpc --std=c++11 -qopenmp -fast -unroll-aggressive -O3 -o ../mcmd main.cpp
     fi
 fi
@@ -16,7 +16,7 @@ of electrostatic energy.
 #define KB2 1.90619525e-46
 #define KB 1.3806503e-23
 
-double es_fh_corr(System &system, int i, int k, double r, double gaussian_term, double erfc_term) {
+double es_fh_corr_mass(System &system, double reduced_mass, double r, double gaussian_term, double erfc_term) {
     double dE, d2E, d3E, d4E; 
     double corr;
     double rr = r*r;
@@ -29,7 +29,6 @@ double es_fh_corr(System &system, int i, int k, double r, double gaussian_term,
     const double a2 = alpha*alpha;
     const double a3 = a2*alpha;
     const double a4 = a3*alpha;
-    double reduced_mass = (system.molecules[i].mass * system.molecules[k].mass)/(system.molecules[i].mass + system.molecules[k].mass);
 
     if (order != 2 && order != 4) return NAN;
 
@@ -51,93 +50,167 @@ double es_fh_corr(System &system, int i, int k, double r, double gaussian_term,
 
 }
 
+double es_fh_corr(System &system, int i, int k, double r, double gaussian_term, double erfc_term) {
+    double reduced_mass = (system.molecules[i].mass * system.molecules[k].mass)/(system.molecules[i].mass + system.molecules[k].mass);
+    return es_fh_corr_mass(system, reduced_mass, r, gaussian_term, erfc_term);
+}
+
 
 /* entire system self potential sum */
-// only changes when N changes.
+// only changes when N changes; from the movable atoms' sum of C^2 (atomTypesCount()), frozen atoms skipped.
 double coulombic_self(System &system) {
-    
-    double potential=0.0, charge;
     const double alpha=system.constants.ewald_alpha;
     const double sqrtPI = sqrt(M_PI);
- 
-    // loop all atoms but skip frozen atoms   
-    if (system.stats.MCstep == 0 || system.constants.ensemble == ENSEMBLE_UVT) { // only changes if N changes
-    for (int i=0; i<system.molecules.size(); i++) {
-        for (int j=0; j<system.molecules[i].atoms.size(); j++) {
-
-            if (!system.molecules[i].atoms[j].frozen &&
-                system.molecules[i].atoms[j].C != 0) {
-                charge = system.molecules[i].atoms[j].C; 
-                potential -= alpha* charge * charge / sqrtPI; 
-            }        
-        } // end for atom i in molecule j
-    } // end for molecule j
-
-    } // end if re-calculate
-    else {
-        potential = system.stats.es_self.value;
-    }
-    return potential;
+    return -alpha * system.atoms.movable_C2 / sqrtPI;
 }
 
 /* coloumbic_real Ewald result */
-double coulombic_real(System &system) {
-    
-    double potential=0.0, pair_potential=0.0;
+template <int BOX>
+double coulombic_real_box(System &system) {
     const double alpha=system.constants.ewald_alpha;
+    const int natoms = system.atoms.x.size();
+    const int_fast8_t use_simd = system.constants.simd_option && !system.constants.feynman_hibbs;
+    vector<double> thread_pot(threadCount(), 0.0); // summed in thread order below
+
+    #pragma omp parallel
+    {
+    double potential=0.0, pair_potential=0.0;
     double erfc_term; // = erfc(alpha*r);
-    double r;  //  int count =0;
+    double r, d[3];  //  int count =0;
     double gaussian_term;
-
-    for (int i = 0; i < system.molecules.size(); i++) {
-    for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
-    for (int k = i; k < system.molecules.size(); k++) {
-    for (int l = 0; l < system.molecules[k].atoms.size(); l++) {    
-        if (system.molecules[i].frozen && system.molecules[k].frozen) continue; // skip frozens
-        if (system.molecules[i].atoms[j].C == 0 || system.molecules[k].atoms[l].C == 0) continue; // skip 0-energy
+    vector<int> partners;
+    int a, b, i, k;
+
+    #pragma omp for schedule(static, 16)
+    for (a = 0; a < natoms; a++) {
+    i = system.atoms.mol[a];
+    cellPartners(system, a, i+1, 1, partners);
+    if (use_simd) { // vector kernel (simd.cpp) for the other molecules; the intramolecular pairs go below
+        prunePartners(system, a, 1, partners);
+        if (system.atoms.C[a] != 0) potential += es_real_pairs_simd_box<BOX>(system, a, partners.data(), partners.size());
+        partners.clear();
+    }
+    for (b = a+1; b < system.atoms.start[i+1]; b++) partners.push_back(b); // and the rest of its own molecule
+    for (int n = 0; n < partners.size(); n++) {
+        b = partners[n]; k = system.atoms.mol[b];
+        if (system.atoms.frozen[a] && system.atoms.frozen[b]) continue; // skip frozens
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
+        if (system.atoms.C[a] == 0 || system.atoms.C[b] == 0) continue; // skip 0-energy
        
 //        count++;
         pair_potential = 0; 
                 
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system,i,j,k,l);
-        r = distances[3];
-        //r = system.pairs[i][j][k][l].r;
+        r = sqrt(getDistance2<BOX>(system, a, b, d));
 
         if (r < system.pbc.cutoff && (i < k)) { // only pairs and not beyond cutoff
             erfc_term = erfc(alpha*r);
-            pair_potential += system.molecules[i].atoms[j].C * system.molecules[k].atoms[l].C * erfc_term / r;  // positive (inter)
+            pair_potential += system.atoms.C[a] * system.atoms.C[b] * erfc_term / r;  // positive (inter)
         
             if (system.constants.feynman_hibbs) {
                 gaussian_term = exp(-alpha*alpha*r*r);
                 pair_potential += es_fh_corr(system, i, k, r, gaussian_term, erfc_term);
             }
         
-        } else if (i == k && j < l) { // self molecule interaction
-            pair_potential -= (system.molecules[i].atoms[j].C * system.molecules[k].atoms[l].C * erf(alpha*r) / r); // negative (intra)
+        } else if (i == k) { // self molecule interaction (b > a)
+            pair_potential -= (system.atoms.C[a] * system.atoms.C[b] * erf(alpha*r) / r); // negative (intra)
         }
         if (std::isnan(potential) == 0) { // CHECK FOR NaN
             potential += pair_potential;
         }
 
-    } // end l
-    } // end k
-    } // end j
-    } // end i 
+    } // end partners b
+    } // end a
+    thread_pot[threadId()] = potential;
+    } // end parallel region
 //    printf("alpha = %f; es_real = %f; count = %i\n", alpha, potential, count);
-    return potential; 
+    return sumThreads(thread_pot);
+}
+
+double coulombic_real(System &system) {
+    if (system.constants.fused_done) return system.constants.fused_es_real; // from fused_pairs_sweep() (polar.cpp)
+    return BOX_DISPATCH(system, coulombic_real_box, system);
+}
+
+/* real-space Ewald terms of one molecule with the rest of the system, plus its own
+intramolecular (erf) correction. For MC energy differences. */
+template <int BOX>
+double coulombic_real_molecule_box(System &system, int molid) {
+
+    double potential=0.0, pair_potential=0.0;
+    const double alpha=system.constants.ewald_alpha;
+    double erfc_term;
+    double r, d[3];
+    double gaussian_term;
+    vector<int> &partners = system.atoms.partners;
+    int a, b, k;
+
+    const int_fast8_t use_simd = system.constants.simd_option && !system.constants.feynman_hibbs;
+
+    for (a = system.atoms.start[molid]; a < system.atoms.start[molid+1]; a++) {
+    if (system.atoms.C[a] == 0) continue;
+    cellPartners(system, a, 0, 1, partners);
+    if (use_simd) { // vector kernel (simd.cpp) for the other molecules; the intramolecular pairs go below
+        prunePartners(system, a, 1, partners);
+        potential += es_real_pairs_simd_box<BOX>(system, a, partners.data(), partners.size());
+        partners.clear();
+    }
+    for (b = a+1; b < system.atoms.start[molid+1]; b++) partners.push_back(b); // intramolecular pairs once
+    for (int n = 0; n < partners.size(); n++) {
+        b = partners[n]; k = system.atoms.mol[b];
+        if (system.atoms.frozen[a] && system.atoms.frozen[b]) continue; // skip frozens
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
+        if (system.atoms.C[b] == 0) continue; // skip 0-energy
+
+        pair_potential = 0;
+
+        r = sqrt(getDistance2<BOX>(system, a, b, d));
+
+        if (k != molid) {
+            if (r < system.pbc.cutoff) {
+                erfc_term = erfc(alpha*r);
+                pair_potential += system.atoms.C[a] * system.atoms.C[b] * erfc_term / r;
+
+                if (system.constants.feynman_hibbs) {
+                    gaussian_term = exp(-alpha*alpha*r*r);
+                    pair_potential += es_fh_corr(system, molid, k, r, gaussian_term, erfc_term);
+                }
+            }
+        } else { // self molecule interaction
+            pair_potential -= (system.atoms.C[a] * system.atoms.C[b] * erf(alpha*r) / r);
+        }
+        if (std::isnan(pair_potential) == 0) { // CHECK FOR NaN
+            potential += pair_potential;
+        }
+
+    } // end partners b
+    } // end a
+    return potential;
+}
+
+double coulombic_real_molecule(System &system, int molid) {
+    return BOX_DISPATCH(system, coulombic_real_molecule_box, system, molid);
 }
 
 // no pbc force
 void coulombic_force_nopbc(System &system) {
     
+    const int natoms = system.atoms.x.size();
+    vector<double> thread_f(threadCount()*4*natoms, 0.0); // see addThreadForces()
+
+    #pragma omp parallel
+    {
+    double *tf = &thread_f[threadId()*4*natoms];
     double charge1, charge2, r,rsq;
     double u[3]; double holder;
 
+    #pragma omp for schedule(static, 1)
     for (int i = 0; i < system.molecules.size(); i++) {
     for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
+    const int a = system.atoms.start[i]+j;
     for (int k = i+1; k < system.molecules.size(); k++) {
     for (int l = 0; l < system.molecules[k].atoms.size(); l++) {
+    const int b = system.atoms.start[k]+l;
     if (!(system.molecules[i].frozen && system.molecules[k].frozen) &&
         !(system.molecules[i].atoms[j].C == 0 || system.molecules[i].atoms[j].C == 0) ) { // don't do frozen-frozen or zero charge
 
@@ -145,7 +218,8 @@ void coulombic_force_nopbc(System &system) {
         charge2 = system.molecules[k].atoms[l].C;
 
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system,i,j,k,l);
+        double distances[4];
+        getDistanceXYZ(system,i,j,k,l, distances);
         r = distances[3];
 
         rsq = r*r;
@@ -153,31 +227,42 @@ void coulombic_force_nopbc(System &system) {
 
             for (int n=0; n<3; n++) {
                 holder = charge1*charge2/rsq * u[n];
-                system.molecules[i].atoms[j].force[n] += holder;
-                system.molecules[k].atoms[l].force[n] -= holder;
+                tf[n*natoms + a] += holder;
+                tf[n*natoms + b] -= holder;
 
             }
-        system.molecules[i].atoms[j].V += charge1*charge2/r;
+        tf[3*natoms + a] += charge1*charge2/r;
 
     } // end if not frozen
     } // end l
     } // end k
     } // end j
     } // end i 
+    } // end parallel region
+    addThreadForces(system, thread_f);
 }
 
 // pbc force via ewald -dU/dx, -dU/dy, -dU/dz
 void coulombic_real_force(System &system) {
     const double alpha=system.constants.ewald_alpha;
+    const double sqrtPI = sqrt(M_PI);
+    const int natoms = system.atoms.x.size();
+    vector<double> thread_f(threadCount()*4*natoms, 0.0); // see addThreadForces()
+
+    #pragma omp parallel
+    {
+    double *tf = &thread_f[threadId()*4*natoms];
     double erfc_term; // = erfc(alpha*r);
     double charge1, charge2, chargeprod, r,rsq;
     double u[3]; double holder;
-    const double sqrtPI = sqrt(M_PI);
 
+    #pragma omp for schedule(static, 1)
     for (int i = 0; i < system.molecules.size(); i++) {
     for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
+    const int a = system.atoms.start[i]+j;
     for (int k = 0; k < system.molecules.size(); k++) {
     for (int l = 0; l < system.molecules[k].atoms.size(); l++) {
+    const int b = system.atoms.start[k]+l;
     if (!(system.molecules[i].frozen && system.molecules[k].frozen) &&
         !(system.molecules[i].atoms[j].C == 0 || system.molecules[i].atoms[j].C == 0) ) { // don't do frozen-frozen or zero charge
 
@@ -186,7 +271,8 @@ void coulombic_real_force(System &system) {
         chargeprod=charge1*charge2;
 
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system,i,j,k,l);
+        double distances[4];
+        getDistanceXYZ(system,i,j,k,l, distances);
         r = distances[3];
 
         rsq = r*r;
@@ -196,16 +282,16 @@ void coulombic_real_force(System &system) {
             erfc_term = erfc(alpha*r);
             for (int n=0; n<3; n++) {
                 holder = -((-2.0*chargeprod*alpha*exp(-alpha*alpha*r*r))/(sqrtPI*r) - (chargeprod*erfc_term/rsq))*u[n];
-                system.molecules[i].atoms[j].force[n] += holder;
-                system.molecules[k].atoms[l].force[n] -= holder;
+                tf[n*natoms + a] += holder;
+                tf[n*natoms + b] -= holder;
 
             }
             //system.molecules[i].atoms[j].V += charge1 * charge2 * erfc_term / r;
         } else if (i == k && j != l) { // self molecule interaction
             for (int n=0; n<3; n++) {
                 holder = -((chargeprod*erf(alpha*r))/rsq - (2*chargeprod*alpha*exp(-alpha*alpha*r*r)/(sqrtPI*r)))*u[n];
-                system.molecules[i].atoms[j].force[n] += holder;
-                system.molecules[k].atoms[l].force[n] -= holder;
+                tf[n*natoms + a] += holder;
+                tf[n*natoms + b] -= holder;
                 
             }
 
@@ -216,7 +302,8 @@ void coulombic_real_force(System &system) {
     } // end k
     } // end j
     } // end i    
-
+    } // end parallel region
+    addThreadForces(system, thread_f);
  
 }
 
@@ -240,7 +327,8 @@ void oldCoulombicForce(System &system) {
         charge2 = system.molecules[k].atoms[l].C;
 
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system,i,j,k,l);
+        double distances[4];
+        getDistanceXYZ(system,i,j,k,l, distances);
         r = distances[3];
 
         rsq = r*r;
@@ -274,29 +362,25 @@ void oldCoulombicForce(System &system) {
 */
 
 
-// Coulombic reciprocal electrostatic energy from Ewald //
-double coulombic_reciprocal(System &system) {   
-    int p, q, l[3], i, j;
-    double k[3], k_sq, position_product;
-    double SF_re=0, SF_im=0;
-    double potential = 0.0;
-
+// (re)build the table of reciprocal lattice vectors used in the Ewald sum.
+// each entry keeps its integer indices l[0..2] and the prefactor 4pi/V exp(-k^2/4a^2)/k^2.
+// only depends on the cell and alpha, so it's redone in defineBox() (NPT).
+void coulombic_kvectors(System &system) {
+    int p, q, l[3];
+    double k[3], k_sq;
     const double alpha = system.constants.ewald_alpha;
-    const int kmax = system.constants.ewald_kmax;   
+    const int kmax = system.constants.ewald_kmax;
 
-   // get recip (re-calc only needed for NPT)
-   if (system.constants.ensemble == ENSEMBLE_NPT) {
-        system.pbc.calcVolume();
-        system.pbc.calcRecip(); 
-   }
+    system.constants.ewald_kl.clear();
+    system.constants.ewald_prefactor.clear();
 
     // fourier sum over a hemisphere (skipping certain points to avoid overcounting the face //
     for (l[0] = 0; l[0] <= kmax; l[0]++) {
         for (l[1] = (!l[0] ? 0 : -kmax); l[1] <= kmax; l[1]++) {
             for (l[2] = ((!l[0] && !l[1]) ? 1 : -kmax); l[2] <= kmax; l[2]++) {
-        
+
                 // skip if norm is out of sphere
-                if (l[0]*l[0] + l[1]*l[1] + l[2]*l[2] > kmax*kmax) continue;   
+                if (l[0]*l[0] + l[1]*l[1] + l[2]*l[2] > kmax*kmax) continue;
 
                 // get reciprocal lattice vectors
                 for (p=0; p<3; p++) {
@@ -306,34 +390,113 @@ double coulombic_reciprocal(System &system) {
                 }
                 k_sq = k[0]*k[0] + k[1]*k[1] + k[2]*k[2];
 
-                // Structure factor. Loop all atoms.
-                SF_re =0.0; SF_im = 0;
-                for (i=0; i<system.molecules.size(); i++) {
-                    for (j=0; j<system.molecules[i].atoms.size(); j++) {
-                        if (system.molecules[i].atoms[j].frozen) continue;
-                        if (system.molecules[i].atoms[j].C == 0) continue;
+                for (p=0; p<3; p++) system.constants.ewald_kl.push_back(l[p]);
+                system.constants.ewald_prefactor.push_back(4.0 * M_PI / system.pbc.volume * exp(-k_sq/(4.0*alpha*alpha)) / k_sq);
 
-                        // inner product of position vector and k vector
-                        position_product = (k[0]*system.molecules[i].atoms[j].pos[0] + k[1]*system.molecules[i].atoms[j].pos[1] + k[2]*system.molecules[i].atoms[j].pos[2]);
+            } // end for l[2], n
+        } // end for l[1], m
+    } // end for l[0], l
+}
 
-                        SF_re += system.molecules[i].atoms[j].C * cos(position_product);
-                        SF_im += system.molecules[i].atoms[j].C * sin(position_product);
+// add sign * q e^{ik.r} of flat atom a to the stored structure factors n0 <= n < n1.
+// e^{ik.r} = prod_q e^{i l[q] theta[q]}, theta[q] = 2pi (recip^T r)[q], so only
+// 3 cos/sin pairs per atom are needed; the powers come from a product recurrence.
+// eik_re/eik_im are scratch space of 3*(kmax+1)
+void coulombic_add_sf_range(System &system, int a, double sign, double *eik_re, double *eik_im, int n0, int n1) {
+    int p, q, m, n;
+    double theta, re, im, tmp;
+    const int kmax = system.constants.ewald_kmax;
+    const double charge = sign * system.atoms.C[a];
+    const double pos[3] = {system.atoms.x[a], system.atoms.y[a], system.atoms.z[a]};
+    const int *kl = &system.constants.ewald_kl[0];
+
+    for (q=0; q<3; q++) {
+        for (p=0, theta=0; p<3; p++)
+            theta += 2.0*M_PI*system.pbc.reciprocal_basis[p][q] * pos[p];
+        eik_re[q*(kmax+1)] = 1.0; eik_im[q*(kmax+1)] = 0.0;
+        if (kmax > 0) { eik_re[q*(kmax+1)+1] = cos(theta); eik_im[q*(kmax+1)+1] = sin(theta); }
+        for (m=2; m<=kmax; m++) {
+            eik_re[q*(kmax+1)+m] = eik_re[q*(kmax+1)+m-1]*eik_re[q*(kmax+1)+1] - eik_im[q*(kmax+1)+m-1]*eik_im[q*(kmax+1)+1];
+            eik_im[q*(kmax+1)+m] = eik_re[q*(kmax+1)+m-1]*eik_im[q*(kmax+1)+1] + eik_im[q*(kmax+1)+m-1]*eik_re[q*(kmax+1)+1];
+        }
+    }
 
-                    } // end for atom j in molecule i
-                } // end for molecule i           
+    for (n=n0; n<n1; n++) {
+        re = 1.0; im = 0.0;
+        for (q=0; q<3; q++) {
+            m = kl[3*n+q];
+            double pre = eik_re[q*(kmax+1) + abs(m)];
+            double pim = (m < 0) ? -eik_im[q*(kmax+1) - m] : eik_im[q*(kmax+1) + m]; // e^{-ix} = conj(e^{ix})
+            tmp = re*pre - im*pim;
+            im = re*pim + im*pre;
+            re = tmp;
+        }
+        system.constants.ewald_sf_re[n] += charge * re;
+        system.constants.ewald_sf_im[n] += charge * im;
+    }
+}
 
-                potential += exp(-k_sq/(4.0*alpha*alpha)) / k_sq * (SF_re*SF_re + SF_im*SF_im);
+// ... and to all of them
+void coulombic_add_sf(System &system, int a, double sign, double *eik_re, double *eik_im) {
+    coulombic_add_sf_range(system, a, sign, eik_re, eik_im, 0, system.constants.ewald_prefactor.size());
+}
 
-            } // end for l[2], n
-        } // end for l[1], m
-    } // end for l[0], l
+// reciprocal energy from the stored structure factors (no atom loop)
+double coulombic_reciprocal_sf(System &system) {
+    double potential = 0.0;
+    const int nk = system.constants.ewald_prefactor.size();
 
-    potential *= 4.0 * M_PI / system.pbc.volume;
+    for (int n=0; n<nk; n++)
+        potential += system.constants.ewald_prefactor[n] * (system.constants.ewald_sf_re[n]*system.constants.ewald_sf_re[n] + system.constants.ewald_sf_im[n]*system.constants.ewald_sf_im[n]);
 
+    return potential;
+}
+
+// Coulombic reciprocal electrostatic energy from Ewald //
+// also (re)builds the stored per-k structure factors used by the MC moves
+double coulombic_reciprocal(System &system) {   
+    const int kmax = system.constants.ewald_kmax;
+
+    if (system.constants.ewald_prefactor.empty()) coulombic_kvectors(system);
+    const int nk = system.constants.ewald_prefactor.size();
+
+    system.constants.ewald_sf_re.assign(nk, 0.0);
+    system.constants.ewald_sf_im.assign(nk, 0.0);
+
+    // Structure factor. Loop all atoms.
+    // each thread owns a block of k-vectors, so no two write the same SF and the
+    // sums come out the same for any number of threads
+    #pragma omp parallel
+    {
+    int n0, n1;
+    threadBlock(nk, &n0, &n1);
+    vector<double> eik_re(3*(kmax+1)), eik_im(3*(kmax+1));
+    for (int a=0; a<system.atoms.x.size(); a++) {
+        if (system.atoms.frozen[a]) continue;
+        if (system.atoms.C[a] == 0) continue;
+        coulombic_add_sf_range(system, a, 1.0, &eik_re[0], &eik_im[0], n0, n1);
+    } // end for atom a
+    } // end parallel region
+
+    double potential = coulombic_reciprocal_sf(system);
     //printf("coulombic_reciprocal: %f K\n",potential);
    return potential;
 }
 
+// add (sign=1) or take out (sign=-1) the structure factor contributions of one molecule.
+// the stored SF's come from the last full coulombic_reciprocal() and are restored on MC reject.
+void coulombic_reciprocal_molecule(System &system, int molid, double sign) {
+    const int kmax = system.constants.ewald_kmax;
+    if (system.molecules[molid].frozen) return;
+    vector<double> &eik_re = system.constants.ewald_eik_re, &eik_im = system.constants.ewald_eik_im;
+    eik_re.resize(3*(kmax+1)); eik_im.resize(3*(kmax+1));
+
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++) {
+        if (system.atoms.C[a] == 0) continue;
+        coulombic_add_sf(system, a, sign, &eik_re[0], &eik_im[0]);
+    }
+}
+
 
 
 double coulombic_ewald(System &system) {
@@ -357,30 +520,46 @@ double coulombic_ewald(System &system) {
 
 double coulombic(System &system) { // old super basic coulombic
    // plain old coloumb
-   double potential = 0;
-   double r, q1, q2;
+   const int natoms = system.atoms.x.size();
+   vector<double> thread_pot(threadCount(), 0.0); // summed in thread order below
    
-    for (int i = 0; i < system.molecules.size(); i++) {
-    for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
-    for (int k = i+1; k < system.molecules.size(); k++) {
-    for (int l =0; l < system.molecules[k].atoms.size(); l++) { 
-        if (!(system.molecules[i].atoms[j].C == 0 || system.molecules[k].atoms[l].C ==0)) {
-        
-        double* distances = getDistanceXYZ(system,i,j,k,l);
-        r = distances[3];
-        //r = system.pairs[i][j][k][l].r;
+    #pragma omp parallel
+    {
+    double potential = 0;
+    double r, d[3];
+    #pragma omp for schedule(static, 16)
+    for (int a = 0; a < natoms; a++) {
+    if (system.atoms.C[a] == 0) continue;
+    for (int b = system.atoms.start[system.atoms.mol[a]+1]; b < natoms; b++) {
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
+        if (system.atoms.C[b] == 0) continue;
+
+        r = getDistanceAtoms(system, a, b, d);
+        potential += system.atoms.C[a]*system.atoms.C[b]/r;
+    } // end b
+    } // end a
+    thread_pot[threadId()] = potential;
+    } // end parallel region
+    return sumThreads(thread_pot);
+}
 
-        q1 = system.molecules[i].atoms[j].C;
-        q2 = system.molecules[k].atoms[l].C;
-        
-        potential += q1*q2/r;
-        } // end if nonzero charges
-    } // end l
-    } // end k
-    } // end j
-    } // end i
+// plain coulomb of one molecule with the rest of the system
+double coulombic_molecule(System &system, int molid) {
+   double potential = 0;
+   double r, d[3];
+   const int natoms = system.atoms.x.size();
+   const int first = system.atoms.start[molid], last = system.atoms.start[molid+1];
+
+    for (int a = first; a < last; a++) {
+    if (system.atoms.C[a] == 0) continue;
+    for (int b = 0; b < natoms; b++) {
+        if (b == first) { b = last-1; continue; } // skip own molecule
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
+        if (system.atoms.C[b] == 0) continue;
+
+        r = getDistanceAtoms(system, a, b, d);
+        potential += system.atoms.C[a]*system.atoms.C[b]/r;
+    } // end b
+    } // end a
     return potential;
 }
-
-
-
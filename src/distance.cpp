@@ -3,8 +3,8 @@
 #include <stdlib.h>
 #include <vector>
 
-// by giving molecule/atom IDs
-double * getDistanceXYZ(System &system, int i, int j, int k, int l) {
+// by giving molecule/atom IDs. output gets dx,dy,dz,r
+void getDistanceXYZ(System &system, int i, int j, int k, int l, double *output) {
     if (system.constants.all_pbc) {
    // calculate distance between atoms
         double rimg;
@@ -56,25 +56,75 @@ double * getDistanceXYZ(System &system, int i, int j, int k, int l) {
                 dimg[p] = di[p];
         }
 
-        static double output[4];
         for (p=0;p<3;p++) output[p] = dimg[p];
         output[3] = rimg;
-        return output;
     }
     else // NO PBC calculation.
     {
         // no PBC r
         double d[3];
         for (int n=0; n<3; n++) d[n] = system.molecules[i].atoms[j].pos[n] - system.molecules[k].atoms[l].pos[n];
-        static double output[4];
         for (int p=0; p<3; p++) output[p] = d[p];
         output[3] = sqrt(dddotprod(d, d));
-        return output;
     }
 }
 
-// by giving two r vectors.
-double * getR(System &system, double * com1, double * com2) {
+/* Minimum image by box policy (Pbc::box_policy, picked once in setupBox()).
+The pair kernels are templated on the policy and instantiated once per kind of box, so
+the per-pair work carries no branches on the cell shape:
+  BOX_NONE       no periodic images (all_pbc off)
+  BOX_ORTHO      90/90/90 cell: d -= L rint(d/L) on each axis on its own
+  BOX_TRICLINIC  the full transform through the reciprocal basis (as getDistanceXYZ)
+The ortho path only reads the basis diagonal; the off-diagonal terms of a 90/90/90 cell are
+round-off from cos(90) and leave the triclinic result unchanged in practice. */
+template <int BOX>
+static inline double minimumImage2(const Pbc &pbc, double *d) {
+    int p, q;
+    if (BOX == BOX_ORTHO) {
+        for (p=0; p<3; p++)
+            d[p] -= pbc.basis[p][p]*rint(pbc.reciprocal_basis[p][p]*d[p]);
+    } else if (BOX == BOX_TRICLINIC) {
+        double img[3], di[3];
+        for (p=0; p<3; p++) {
+            img[p] = 0;
+            for (q=0; q<3; q++)
+                img[p] += pbc.reciprocal_basis[q][p]*d[q];
+            img[p] = rint(img[p]);
+        }
+        for (p=0; p<3; p++) {
+            di[p] = 0;
+            for (q=0; q<3; q++)
+                di[p] += pbc.basis[q][p]*img[q];
+        }
+        for (p=0; p<3; p++)
+            d[p] -= di[p];
+    }
+    return d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+}
+
+// flat atoms a,b (system.atoms): d gets the minimum-image displacement a-b; returns r^2 (no sqrt)
+template <int BOX>
+static inline double getDistance2(System &system, int a, int b, double *d) {
+    d[0] = system.atoms.x[a] - system.atoms.x[b];
+    d[1] = system.atoms.y[a] - system.atoms.y[b];
+    d[2] = system.atoms.z[a] - system.atoms.z[b];
+    return minimumImage2<BOX>(system.pbc, d);
+}
+
+// kernel<BOX>(...) for the box policy of this system. for the templated pair kernels'
+// entry points, so the policy is looked at once per pass instead of once per pair
+#define BOX_DISPATCH(system, kernel, ...) \
+    ((system).pbc.box_policy == BOX_ORTHO ? kernel<BOX_ORTHO>(__VA_ARGS__) : \
+     (system).pbc.box_policy == BOX_TRICLINIC ? kernel<BOX_TRICLINIC>(__VA_ARGS__) : \
+     kernel<BOX_NONE>(__VA_ARGS__))
+
+// by giving two flat atom indices (system.atoms). d gets the minimum-image displacement a-b; returns r
+double getDistanceAtoms(System &system, int a, int b, double *d) {
+    return sqrt(BOX_DISPATCH(system, getDistance2, system, a, b, d));
+}
+
+// by giving two r vectors. output gets dx,dy,dz,r
+void getR(System &system, double * com1, double * com2, double *output) {
         double rimg;
         double d[3],di[3],img[3],dimg[3];
         int p,q;
@@ -124,12 +174,8 @@ double * getR(System &system, double * com1, double * com2) {
                 dimg[p] = di[p];
         }
 
-        
-        static double output[4];
         for (p=0; p<3; p++) output[p] = dimg[p];
         output[3] = rimg;
-        return output;
-    
 }
 
 
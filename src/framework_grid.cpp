@@ -0,0 +1,372 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include <vector>
+
+using namespace std;
+
+/* Tabulated framework potential (MC only).
+The frozen atoms never move, so the LJ (+FH) and real-space ES they exert on
+a sorbate site are precomputed once on a grid spanning the unit cell -- one grid
+per distinct sorbate site type -- and read back with tricubic interpolation.
+Sorbate-framework energy is then O(sorbate sites) no matter the framework size.
+With fgrid_efield the framework's static (Wolf) field, which polarization needs at
+every sorbate site, is tabulated the same way -- one 3-component grid, since the
+field does not depend on the site type.
+*/
+
+#define FGRID_MAX 1.0e12 // K. grid values are clamped here (and set here inside auto_reject_r, with auto_reject_option on)
+#define FGRID_WALL 1.0e6 // K. a stencil reaching this high is interpolated trilinearly; the cubic would overshoot
+
+// find (or make) the grid that serves this sorbate site
+int fgrid_type(System &system, double sig, double eps, double C, double mass) {
+    if (!system.constants.feynman_hibbs) mass = 0; // only FH cares about the molecule mass
+    for (int n=0; n<system.grids.framework.size(); n++) {
+        fgrid_t &g = system.grids.framework[n];
+        if (g.sig == sig && g.eps == eps && g.C == C && g.mass == mass) return n;
+    }
+    fgrid_t g;
+    g.sig = sig; g.eps = eps; g.C = C; g.mass = mass;
+    system.grids.framework.push_back(g);
+    return (int)system.grids.framework.size()-1;
+}
+
+// the frozen atoms, flattened for the grid build
+typedef struct _fgrid_frozen {
+    vector<double> frac; // fractional coords, 3 per atom
+    vector<double> eps, sig, C, mass; // mass is the molecule's, for FH
+} fgrid_frozen_t;
+
+// framework LJ and ES potentials felt by every site type at fractional point frac.
+// writes one value per grid into rd[] and es[], and the static field (as thole_field()) into field[3] if given
+void fgrid_point(System &system, fgrid_frozen_t &fz, double *frac, double *rd, double *es, double *field) {
+    const double cutoff = system.pbc.cutoff;
+    const double alpha = system.constants.ewald_alpha;
+    const int ntypes = system.grids.framework.size();
+    // can far atoms be skipped before the sqrt?
+    const int_fast8_t cut_all = system.constants.rd_lrc && system.constants.ewald_es;
+    double d[3], df[3], r, r2, sr6, eps, sig, erfc_term, gaussian_term, reduced_mass;
+    int n, p, q;
+    // wolf field terms, see thole_field()
+    const double wa = system.constants.polar_wolf_alpha;
+    const double rR = 1./cutoff;
+    const double cutoffterm = erfc(wa*cutoff)*rR*rR + wa*M_2_SQRTPI*exp(-wa*wa*cutoff*cutoff)*rR;
+    double f;
+
+    for (n=0; n<ntypes; n++) { rd[n] = 0; es[n] = 0; }
+    if (field) field[0] = field[1] = field[2] = 0;
+
+    for (int l=0; l<fz.eps.size(); l++) {
+        // minimum image in fractional space
+        for (p=0; p<3; p++) {
+            df[p] = frac[p] - fz.frac[3*l+p];
+            df[p] -= rint(df[p]);
+        }
+        for (p=0; p<3; p++) {
+            d[p] = 0;
+            for (q=0; q<3; q++)
+                d[p] += system.pbc.basis[q][p]*df[q];
+        }
+        r2 = d[0]*d[0] + d[1]*d[1] + d[2]*d[2];
+        if (cut_all && r2 > cutoff*cutoff && !field) continue;
+        r = sqrt(r2);
+        erfc_term = -1; // computed once if needed
+
+        if (field && fz.C[l] != 0 && r - 1e-12 < cutoff && r != 0.) {
+            if (wa == 0)
+                f = (1.0/r2 - rR*rR)/r;
+            else
+                f = (erfc(wa*r)/r2 + wa*M_2_SQRTPI*exp(-wa*wa*r2)/r - cutoffterm)/r;
+            for (p=0; p<3; p++)
+                field[p] += fz.C[l]*f*d[p];
+        }
+        if (cut_all && r2 > cutoff*cutoff) continue;
+
+        for (n=0; n<ntypes; n++) {
+            fgrid_t &g = system.grids.framework[n];
+            reduced_mass = g.mass*fz.mass[l] / (g.mass + fz.mass[l]);
+
+            // LJ, same mixing and cutoff rules as lj()
+            eps = g.eps; sig = g.sig;
+            if (eps != fz.eps[l])
+                eps = sqrt(eps * fz.eps[l]);
+            if (sig != fz.sig[l])
+                sig = 0.5 * (sig + fz.sig[l]);
+            if (sig != 0 && eps != 0) {
+                if (system.constants.auto_reject_option && r <= system.constants.auto_reject_r) rd[n] += FGRID_MAX; // a bad contact, as in lj()
+                else if (!system.constants.rd_lrc || r <= cutoff) {
+                    sr6 = sig/r;
+                    sr6 *= sr6;
+                    sr6 *= sr6*sr6;
+                    rd[n] += 4.0*eps*(sr6*sr6 - sr6);
+                    if (system.constants.feynman_hibbs)
+                        rd[n] += lj_fh_corr_mass(system, reduced_mass, r, sr6*sr6, sr6, sig, eps);
+                }
+            }
+
+            // ES, same rules as coulombic_real() (or coulombic())
+            if (g.C != 0 && fz.C[l] != 0) {
+                if (!system.constants.ewald_es)
+                    es[n] += g.C * fz.C[l] / r;
+                else if (r < cutoff) {
+                    if (erfc_term < 0) erfc_term = erfc(alpha*r);
+                    es[n] += g.C * fz.C[l] * erfc_term / r;
+                    if (system.constants.feynman_hibbs) {
+                        gaussian_term = exp(-alpha*alpha*r*r);
+                        es[n] += es_fh_corr_mass(system, reduced_mass, r, gaussian_term, erfc_term);
+                    }
+                }
+            }
+        } // end n
+    } // end l
+
+    // keep the numbers sane for interpolation
+    for (n=0; n<ntypes; n++) {
+        if (!(rd[n] < FGRID_MAX)) rd[n] = FGRID_MAX;
+        if (!(es[n] < FGRID_MAX)) es[n] = FGRID_MAX;
+        else if (es[n] < -FGRID_MAX) es[n] = -FGRID_MAX;
+    }
+    if (field)
+        for (p=0; p<3; p++) {
+            if (!(field[p] < FGRID_MAX)) field[p] = FGRID_MAX;
+            else if (field[p] < -FGRID_MAX) field[p] = -FGRID_MAX;
+        }
+}
+
+// stencil and weights of the tricubic (Catmull-Rom) interpolation at cartesian pos
+// on a periodic grid of dim[0] x dim[1] x dim[2] points. t is where pos falls between idx[p][1] and idx[p][2]
+void fgrid_stencil(System &system, const int *dim, double *pos, int idx[3][4], double w[3][4], double *t3) {
+    double frac[3], t;
+    int p, q;
+
+    for (p=0; p<3; p++) {
+        frac[p] = 0;
+        for (q=0; q<3; q++)
+            frac[p] += system.pbc.reciprocal_basis[q][p]*pos[q];
+        frac[p] = (frac[p] - floor(frac[p])) * dim[p]; // grid units in [0,dim)
+        int i0 = (int)floor(frac[p]);
+        t = frac[p] - i0;
+        t3[p] = t;
+        w[p][0] = 0.5*(-t*t*t + 2.0*t*t - t);
+        w[p][1] = 0.5*(3.0*t*t*t - 5.0*t*t + 2.0);
+        w[p][2] = 0.5*(-3.0*t*t*t + 4.0*t*t + t);
+        w[p][3] = 0.5*(t*t*t - t*t);
+        for (q=0; q<4; q++)
+            idx[p][q] = ((i0 - 1 + q) % dim[p] + dim[p]) % dim[p];
+    }
+}
+
+/* tricubic (Catmull-Rom) interpolation of a periodic grid at cartesian pos.
+ * up against the repulsive wall of an atom the cubic's negative side weights would
+ * overshoot, so there the value is trilinear over the 8 surrounding points instead.
+ * *contact (if given) is set if the grid point nearest pos is clamped. */
+double fgrid_interp(System &system, fgrid_t &g, vector<double> &grid, double *pos, int *contact) {
+    double w[3][4], t[3];
+    int idx[3][4], a, b, c, wall = 0;
+    fgrid_stencil(system, g.dim, pos, idx, w, t);
+
+    double value = 0, v;
+    for (a=0; a<4; a++) {
+    for (b=0; b<4; b++) {
+    for (c=0; c<4; c++) {
+        v = grid[(idx[0][a]*g.dim[1] + idx[1][b])*g.dim[2] + idx[2][c]];
+        if (fabs(v) >= FGRID_WALL) wall = 1;
+        value += w[0][a]*w[1][b]*w[2][c]*v;
+    }
+    }
+    }
+    if (!wall) return value;
+
+    a = t[0] < 0.5 ? 1 : 2; b = t[1] < 0.5 ? 1 : 2; c = t[2] < 0.5 ? 1 : 2;
+    if (contact && fabs(grid[(idx[0][a]*g.dim[1] + idx[1][b])*g.dim[2] + idx[2][c]]) >= FGRID_MAX) *contact = 1;
+    value = 0;
+    for (a=0; a<2; a++) {
+    for (b=0; b<2; b++) {
+    for (c=0; c<2; c++) {
+        v = grid[(idx[0][1+a]*g.dim[1] + idx[1][1+b])*g.dim[2] + idx[2][1+c]];
+        value += (a ? t[0] : 1.0-t[0]) * (b ? t[1] : 1.0-t[1]) * (c ? t[2] : 1.0-t[2]) * v;
+    }
+    }
+    }
+    return value;
+}
+
+// framework static field at cartesian pos from the field grid (fgrid_efield), added to field
+void fgrid_efield_at(System &system, double *pos, double *field) {
+    double w[3][4], t[3], wabc;
+    int idx[3][4], a, b, c, n;
+    const int *dim = system.grids.efield_dim;
+    if (system.grids.efield[0].empty()) return; // no grid was made (fgridEfieldOff())
+    fgrid_stencil(system, dim, pos, idx, w, t);
+
+    for (a=0; a<4; a++) {
+    for (b=0; b<4; b++) {
+    for (c=0; c<4; c++) {
+        n = (idx[0][a]*dim[1] + idx[1][b])*dim[2] + idx[2][c];
+        wabc = w[0][a]*w[1][b]*w[2][c];
+        field[0] += wabc*system.grids.efield[0][n];
+        field[1] += wabc*system.grids.efield[1][n];
+        field[2] += wabc*system.grids.efield[2][n];
+    }
+    }
+    }
+}
+
+// framework RD energy of one (movable) molecule from the grids
+double fgrid_rd_molecule(System &system, int molid) {
+    double potential = 0;
+    int contact = 0;
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++) {
+        int id = system.atoms.fgrid_id[a];
+        if (id < 0 || system.grids.framework[id].rd.empty()) continue;
+        double pos[3] = {system.atoms.x[a], system.atoms.y[a], system.atoms.z[a]};
+        potential += fgrid_interp(system, system.grids.framework[id], system.grids.framework[id].rd, pos, &contact);
+    }
+    if (contact && system.constants.auto_reject_option) { // a site within auto_reject_r of the framework
+        system.constants.auto_reject = 1;
+        system.constants.rejects++;
+        return 1e40;
+    }
+    return potential;
+}
+
+// framework real-space ES energy of one (movable) molecule from the grids.
+// contacts are only checked on the RD grid (fgrid_rd_molecule()), so this never auto-rejects
+double fgrid_es_molecule(System &system, int molid) {
+    double potential = 0;
+    for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++) {
+        int id = system.atoms.fgrid_id[a];
+        if (id < 0 || system.grids.framework[id].es.empty()) continue;
+        double pos[3] = {system.atoms.x[a], system.atoms.y[a], system.atoms.z[a]};
+        potential += fgrid_interp(system, system.grids.framework[id], system.grids.framework[id].es, pos, NULL);
+    }
+    return potential;
+}
+
+// framework RD energy of all movables
+double fgrid_rd(System &system) {
+    double potential = 0;
+    for (int i=0; i<system.molecules.size(); i++) {
+        if (system.molecules[i].frozen) continue;
+        potential += fgrid_rd_molecule(system, i);
+        if (system.constants.auto_reject_option && system.constants.auto_reject) return 1e40;
+    }
+    return potential;
+}
+
+// framework real-space ES energy of all movables
+double fgrid_es(System &system) {
+    double potential = 0;
+    for (int i=0; i<system.molecules.size(); i++) {
+        if (system.molecules[i].frozen) continue;
+        potential += fgrid_es_molecule(system, i);
+    }
+    return potential;
+}
+
+// the field grid comes with the framework grid; where that isn't made, fgrid_efield goes too
+void fgridEfieldOff(System &system) {
+    if (!system.constants.fgrid_efield) return;
+    printf("WARNING: fgrid_efield needs the framework grid (fgrid_option). Turning it off.\n");
+    system.constants.fgrid_efield = 0;
+}
+
+void setupFrameworkGrid(System &system) {
+    int_fast8_t model = system.constants.potential_form;
+    int i, j, n, p, q, a, b, c;
+
+    if (!(model == POTENTIAL_LJ || model == POTENTIAL_LJES || model == POTENTIAL_LJPOLAR || model == POTENTIAL_LJESPOLAR)) {
+        printf("WARNING: fgrid_option is only available for LJ potentials. Turning it off.\n");
+        system.constants.fgrid_option = 0;
+        fgridEfieldOff(system);
+        return;
+    }
+    if (system.constants.mode != "mc" || system.constants.ensemble == ENSEMBLE_NPT || system.stats.count_frozens == 0 || !system.constants.all_pbc) {
+        printf("WARNING: fgrid_option needs a fixed periodic cell and frozen atoms. Turning it off.\n");
+        system.constants.fgrid_option = 0;
+        fgridEfieldOff(system);
+        return;
+    }
+
+    // site types: everything that can move, now or after insertion
+    for (i=0; i<system.molecules.size(); i++) {
+        if (system.molecules[i].frozen) continue;
+        for (j=0; j<system.molecules[i].atoms.size(); j++)
+            system.molecules[i].atoms[j].fgrid_id = fgrid_type(system, system.molecules[i].atoms[j].sig, system.molecules[i].atoms[j].eps, system.molecules[i].atoms[j].C, system.molecules[i].mass);
+    }
+    for (i=0; i<system.proto.size(); i++)
+        for (j=0; j<system.proto[i].atoms.size(); j++)
+            system.proto[i].atoms[j].fgrid_id = fgrid_type(system, system.proto[i].atoms[j].sig, system.proto[i].atoms[j].eps, system.proto[i].atoms[j].C, system.proto[i].mass);
+
+    // grid points along each cell vector
+    int dim[3];
+    for (p=0; p<3; p++) {
+        double len = sqrt(dddotprod(system.pbc.basis[p], system.pbc.basis[p]));
+        dim[p] = (int)ceil(len/system.constants.fgrid_resolution);
+        if (dim[p] < 4) dim[p] = 4;
+    }
+
+    if (system.constants.fgrid_efield && !(model == POTENTIAL_LJPOLAR || model == POTENTIAL_LJESPOLAR)) {
+        printf("WARNING: fgrid_efield is only used by polarizable models. Turning it off.\n");
+        system.constants.fgrid_efield = 0;
+    }
+    if (system.constants.fgrid_efield && !system.constants.mc_pbc) {
+        printf("WARNING: fgrid_efield needs the periodic (Wolf) polarization field. Turning it off.\n");
+        system.constants.fgrid_efield = 0;
+    }
+    if (system.constants.fgrid_efield) {
+        for (p=0; p<3; p++) {
+            system.grids.efield_dim[p] = dim[p];
+            system.grids.efield[p].resize(dim[0]*dim[1]*dim[2]);
+        }
+        printf("Framework electric field grid: %i x %i x %i points\n", dim[0], dim[1], dim[2]);
+    }
+
+    const int ntypes = system.grids.framework.size();
+    vector<int_fast8_t> do_rd(ntypes), do_es(ntypes);
+    for (n=0; n<ntypes; n++) {
+        fgrid_t &g = system.grids.framework[n];
+        for (p=0; p<3; p++) g.dim[p] = dim[p];
+        do_rd[n] = (g.sig != 0 && g.eps != 0);
+        do_es[n] = (g.C != 0 && (model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR));
+        if (do_rd[n]) g.rd.resize(dim[0]*dim[1]*dim[2]);
+        if (do_es[n]) g.es.resize(dim[0]*dim[1]*dim[2]);
+        printf("Framework grid %i (sig = %f A, eps = %f K, q = %f e): %i x %i x %i points\n", n, g.sig, g.eps, g.C/system.constants.E2REDUCED, dim[0], dim[1], dim[2]);
+    }
+
+    // flatten the frozen atoms
+    fgrid_frozen_t fz;
+    for (i=0; i<system.molecules.size(); i++) {
+        if (!system.molecules[i].frozen) continue;
+        for (j=0; j<system.molecules[i].atoms.size(); j++) {
+            for (p=0; p<3; p++) {
+                double f = 0;
+                for (q=0; q<3; q++)
+                    f += system.pbc.reciprocal_basis[q][p]*system.molecules[i].atoms[j].pos[q];
+                fz.frac.push_back(f);
+            }
+            fz.eps.push_back(system.molecules[i].atoms[j].eps);
+            fz.sig.push_back(system.molecules[i].atoms[j].sig);
+            fz.C.push_back(system.molecules[i].atoms[j].C);
+            fz.mass.push_back(system.molecules[i].mass);
+        }
+    }
+
+    double frac[3], field[3];
+    vector<double> rd(ntypes), es(ntypes);
+    for (a=0; a<dim[0]; a++) {
+    for (b=0; b<dim[1]; b++) {
+    for (c=0; c<dim[2]; c++) {
+        frac[0] = (double)a/dim[0]; frac[1] = (double)b/dim[1]; frac[2] = (double)c/dim[2];
+        fgrid_point(system, fz, frac, &rd[0], &es[0], system.constants.fgrid_efield ? field : NULL);
+        for (n=0; n<ntypes; n++) {
+            if (do_rd[n]) system.grids.framework[n].rd[(a*dim[1] + b)*dim[2] + c] = rd[n];
+            if (do_es[n]) system.grids.framework[n].es[(a*dim[1] + b)*dim[2] + c] = es[n];
+        }
+        if (system.constants.fgrid_efield)
+            for (p=0; p<3; p++) system.grids.efield[p][(a*dim[1] + b)*dim[2] + c] = field[p];
+    }
+    }
+    }
+    printf("Framework grids done.\n");
+}
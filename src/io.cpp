@@ -57,6 +57,7 @@ void readInAtomsXYZ(System &system, string filename) {
             current_atom.eps = system.constants.eps[current_atom.name];
             current_atom.sig = system.constants.sigs[current_atom.name];
             current_atom.polar = system.constants.polars[current_atom.name];
+            current_atom.type = atomTypeId(system, current_atom.name, current_atom.eps, current_atom.sig);
             //==============================================================
             current_atom.V = 0.0;
 			//current_atom.K = 0.0;
@@ -144,6 +145,7 @@ void readInAtoms(System &system, string filename) {
 
             if (11 < myvector.size() && myvector[11] != "default") current_atom.polar = stod(myvector[11]);
             else current_atom.polar = system.constants.polars[current_atom.name];
+            current_atom.type = atomTypeId(system, current_atom.name, current_atom.eps, current_atom.sig);
             //==============================================================
             current_atom.V = 0.0;
 			//current_atom.K = 0.0;
@@ -1030,6 +1032,59 @@ void readInput(System &system, char* filename) {
                 if (lc[1] == "off") system.constants.polar_palmo = 0;
                 std::cout << "Got Palmo Polarization = " << lc[1].c_str(); printf("\n");
 
+            } else if (!strcasecmp(lc[0].c_str(), "polar_gs")) {
+                if (lc[1] == "on") system.constants.polar_gs = 1;
+                else system.constants.polar_gs = 0;
+                std::cout << "Got Gauss-Seidel polarization sweeps = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_gs_ranked")) {
+                if (lc[1] == "on") system.constants.polar_gs_ranked = 1;
+                else system.constants.polar_gs_ranked = 0;
+                std::cout << "Got ranked Gauss-Seidel polarization sweeps = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_red_black")) {
+                if (lc[1] == "on") system.constants.polar_red_black = 1;
+                else system.constants.polar_red_black = 0;
+                std::cout << "Got red-black polarization sweeps = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_precision")) {
+                system.constants.polar_precision = atof(lc[1].c_str());
+                std::cout << "Got polarization precision = " << lc[1].c_str() << " D"; printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_warm_start")) {
+                if (lc[1] == "on") system.constants.polar_warm_start = 1;
+                else system.constants.polar_warm_start = 0;
+                std::cout << "Got polarization warm start = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_local_radius")) {
+                system.constants.polar_local_radius = atof(lc[1].c_str());
+                std::cout << "Got local polarization radius = " << lc[1].c_str() << " A"; printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_local_refresh")) {
+                system.constants.polar_local_refresh = atoi(lc[1].c_str());
+                if (system.constants.polar_local_refresh < 1) system.constants.polar_local_refresh = 1;
+                std::cout << "Got full polarization solve every " << system.constants.polar_local_refresh << " steps"; printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_matrix_free")) {
+                if (lc[1] == "on") system.constants.polar_matrix_free = 1;
+                else system.constants.polar_matrix_free = 0;
+                std::cout << "Got matrix-free polarization = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_float_matrix")) {
+                if (lc[1] == "on") system.constants.polar_float_matrix = 1;
+                else system.constants.polar_float_matrix = 0;
+                std::cout << "Got single-precision A matrix = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_frozen_cache")) {
+                if (lc[1] == "on") system.constants.polar_frozen_cache = 1;
+                else system.constants.polar_frozen_cache = 0;
+                std::cout << "Got cached frozen-frozen dipole tensor = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "polar_pcg")) {
+                if (lc[1] == "on") system.constants.polar_pcg = 1;
+                else system.constants.polar_pcg = 0;
+                std::cout << "Got conjugate-gradient polarization solver = " << lc[1].c_str(); printf("\n");
+
 
 			} else if (!strcasecmp(lc[0].c_str(), "com_option")) {
 				if (lc[1] == "on") system.constants.com_option = 1;
@@ -1131,6 +1186,49 @@ void readInput(System &system, char* filename) {
                 else system.constants.ewald_es = 0;
                 std::cout << "Got Ewald electrostatics option = " << lc[1].c_str(); printf("\n");
 
+            } else if (!strcasecmp(lc[0].c_str(), "fgrid_option")) {
+                if (lc[1] == "on") system.constants.fgrid_option = 1;
+                else system.constants.fgrid_option = 0;
+                std::cout << "Got framework grid option = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "fgrid_resolution")) {
+                system.constants.fgrid_resolution = atof(lc[1].c_str());
+                std::cout << "Got framework grid resolution = " << lc[1].c_str() << " A"; printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "fgrid_efield")) {
+                if (lc[1] == "on") system.constants.fgrid_efield = 1;
+                else system.constants.fgrid_efield = 0;
+                std::cout << "Got framework electric field grid = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "cell_list_option")) {
+                if (lc[1] == "on") system.constants.cell_list_option = 1;
+                else system.constants.cell_list_option = 0;
+                std::cout << "Got cell list option = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "simd_option")) {
+                if (lc[1] == "on") system.constants.simd_option = 1;
+                else system.constants.simd_option = 0;
+                std::cout << "Got SIMD option = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "fused_pairs")) {
+                if (lc[1] == "on") system.constants.fused_pairs = 1;
+                else system.constants.fused_pairs = 0;
+                std::cout << "Got fused pair kernel option = " << lc[1].c_str(); printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "cutoff")) {
+                system.pbc.cutoff = atof(lc[1].c_str());
+                system.pbc.cutoff_fixed = 1;
+                if (system.pbc.cutoff <= 0) {
+                    printf("ERROR: cutoff must be positive (got %s). Exiting.\n", lc[1].c_str());
+                    exit(1);
+                }
+                std::cout << "Got pair cutoff = " << lc[1].c_str() << " A"; printf("\n");
+
+            } else if (!strcasecmp(lc[0].c_str(), "delta_energy_option")) {
+                if (lc[1] == "on") system.constants.delta_energy_option = 1;
+                else system.constants.delta_energy_option = 0;
+                std::cout << "Got delta energy option for MC moves = " << lc[1].c_str(); printf("\n");
+
             } else if (!strcasecmp(lc[0].c_str(), "pdb_long")) {
                 if (lc[1] == "on") system.constants.pdb_long =1;
                 else system.constants.pdb_long = 0;
@@ -1180,6 +1278,9 @@ void paramOverrideCheck(System &system) {
         
     }
 
+    // sig/eps may have changed, and with them the atom types
+    atomTypesAssign(system);
+
     // universal van Duijnen polarizability parameters
     if (system.constants.polars_vand == 1) {
         for (int i=0; i<system.molecules.size(); i++) {
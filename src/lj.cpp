@@ -11,9 +11,8 @@
 #define KB2 1.90619525e-46
 #define KB 1.3806503e-23
 
-// get the Feynman-Hibbs correction for a pair of atoms
-double lj_fh_corr(System &system, int i,int k, double r, double term12, double term6, double sig, double eps) {
-    double reduced_mass;
+// get the Feynman-Hibbs correction for a pair of atoms, given the pair's reduced mass
+double lj_fh_corr_mass(System &system, double reduced_mass, double r, double term12, double term6, double sig, double eps) {
     double dE, d2E, d3E, d4E; //energy derivatives
     double corr;
     double ir = 1.0/r;
@@ -24,7 +23,6 @@ double lj_fh_corr(System &system, int i,int k, double r, double term12, double t
 
     if (order != 2 && order != 4) return NAN;
 
-    reduced_mass = system.molecules[i].mass*system.molecules[k].mass / (system.molecules[i].mass + system.molecules[k].mass);
     dE = -24.0*eps*(2.0*term12 - term6)*ir;
     d2E = 24.0*eps*(26.0*term12 - 7.0*term6)*ir2;
 
@@ -46,159 +44,182 @@ double lj_fh_corr(System &system, int i,int k, double r, double term12, double t
     return corr;
 }
 
-double self_lj_lrc(System &system) {
-    double potential=0;
+// get the Feynman-Hibbs correction for a pair of atoms in molecules i and k
+double lj_fh_corr(System &system, int i,int k, double r, double term12, double term6, double sig, double eps) {
+    double reduced_mass = system.molecules[i].mass*system.molecules[k].mass / (system.molecules[i].mass + system.molecules[k].mass);
+    return lj_fh_corr_mass(system, reduced_mass, r, term12, term6, sig, eps);
+}
+
+/* The LJ tail corrections only depend on which atoms there are and the volume, so they
+come from the per-type atom counts that the atom arrays keep (atomTypesCount()):
+O(types^2) instead of a loop over every atom pair. */
+
+// lrc of one pair of atom types t, u (0 for a zero-energy pair)
+double lj_lrc_params(System &system, int t, int u) {
     const double cutoff = system.pbc.cutoff;
     const double volume = system.pbc.volume;
-    double sig, eps, sig3,sigcut,sigcut3,sigcut9;
-    double this_self_lrc;
+    const int k = t*system.atomtypes.n + u;
+    const double eps = system.atomtypes.mix_eps[k], sig = system.atomtypes.mix_sig[k];
+    if (sig == 0 || eps == 0) return 0; // skip 0 energy interactions
 
-    if (system.stats.MCstep == 0 || system.constants.ensemble == ENSEMBLE_UVT || system.constants.ensemble == ENSEMBLE_NPT) { // only changes if N or V changes
-    for (int i = 0; i < system.molecules.size(); i++) {
-    for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
-           if (!system.molecules[i].frozen) {
-            sig = system.molecules[i].atoms[j].sig;
-            eps = system.molecules[i].atoms[j].eps;
-    
-            if (!(sig == 0 || eps == 0)) {
-            sig3 = fabs(sig);
-            sig3 *= sig3*sig3;
-            sigcut = fabs(sig)/cutoff;
-            sigcut3 = sigcut*sigcut*sigcut;
-            sigcut9 = sigcut3 * sigcut3 * sigcut3;
+    double sig3 = fabs(sig);
+    sig3 *= sig3*sig3;
+    double sigcut = fabs(sig)/cutoff;
+    double sigcut3 = sigcut * sigcut * sigcut;
+    double sigcut9 = sigcut3 * sigcut3 * sigcut3;
 
+    return (16.0/3.0)*M_PI*eps*sig3*((1.0/3.0)*sigcut9 - sigcut3)/volume;
+}
 
-            this_self_lrc = (16.0/3.0)*M_PI*eps*sig3*((1.0/3.0)*sigcut9 - sigcut3)/volume;
-            potential += this_self_lrc;
-            } // if nonzero sig/eps
+// self lrc of the non-frozen atoms
+double self_lj_lrc(System &system) {
+    double potential=0;
+    const AtomArrays &at = system.atoms;
+    for (int t=0; t<at.type_movable.size(); t++)
+        if (at.type_movable[t])
+            potential += at.type_movable[t] * lj_lrc_params(system, t, t);
+    return potential;
+}
+
+// pair lrc over every pair of atoms (intramolecular ones included) except frozen-frozen
+double lj_lrc(System &system) {
+    double potential=0, pairs;
+    const AtomArrays &at = system.atoms;
+    const int ntypes = at.type_movable.size();
+    int t, u;
+    for (t=0; t<ntypes; t++) {
+        const double nt = at.type_movable[t] + at.type_frozen[t], ft = at.type_frozen[t];
+        for (u=t; u<ntypes; u++) {
+            const double nu = at.type_movable[u] + at.type_frozen[u], fu = at.type_frozen[u];
+            if (u == t)
+                pairs = 0.5*(nt*(nt-1) - ft*(ft-1));
+            else
+                pairs = nt*nu - ft*fu;
+            if (pairs != 0)
+                potential += pairs * lj_lrc_params(system, t, u);
         }
-    } // end for j atom
-    } // end for i molecule
-    } // end if self LRC changes
-    else {
-        potential = system.stats.lj_self_lrc.value;
     }
     return potential;
 }
 
-
-
-double lj(System &system) {
+template <int BOX, int F>
+double lj_box(System &system) {
     double total_pot=0, total_lj=0, total_rd_lrc=0, total_rd_self_lrc = 0;
     const double cutoff = system.pbc.cutoff;
-    const double volume = system.pbc.volume;
-    int i,j,k,l; //index;
-    double this_lj;
-    double r,sr6;
+    const int natoms = system.atoms.x.size();
+    const int_fast8_t use_cells = (F & LJ_LRC) != 0; // cells only cover the cutoff
     const double auto_reject_r = system.constants.auto_reject_r;
-    const int auto_reject_option = system.constants.auto_reject_option;
-
-    for (i = 0; i < system.molecules.size(); i++) {
-    for (j = 0; j < system.molecules[i].atoms.size(); j++) {
-    for (k = i+1; k < system.molecules.size(); k++) {
-    for (l =0; l < system.molecules[k].atoms.size(); l++) {
-
-        //if (system.pairs[i][j][k][l].recalculate) {
-
-        // do mixing rules
-        double eps = system.molecules[i].atoms[j].eps,sig=system.molecules[i].atoms[j].sig;
-        if (eps != system.molecules[k].atoms[l].eps)
-            eps = sqrt(eps * system.molecules[k].atoms[l].eps);
-       
-        if (sig != system.molecules[k].atoms[l].sig)
-         sig = 0.5 * (sig + system.molecules[k].atoms[l].sig);
+    const int auto_reject_option = (F & LJ_REJECT) != 0;
+    const int_fast8_t use_simd = system.constants.simd_option && !(F & LJ_FH);
+    const int ntypes = system.atomtypes.n;
+    const double *mix_eps = &system.atomtypes.mix_eps[0], *mix_sig = &system.atomtypes.mix_sig[0];
+    const double *mix_sig6 = &system.atomtypes.mix_sig6[0], *mix_sig12 = &system.atomtypes.mix_sig12[0];
+
+    if (system.constants.fused_done) { // the pairs were already summed by fused_pairs_sweep() (polar.cpp)
+        if (system.constants.fused_contact) {
+            system.constants.auto_reject = 1;
+            system.constants.rejects++;
+            return 1e40; // a really big energy
+        }
+        total_lj = total_pot = system.constants.fused_lj;
+    } else {
+    // per-thread partial sums, added up in thread order after the loops (usefulmath.cpp)
+    const int nthreads = threadCount();
+    vector<double> thread_lj(nthreads, 0.0), thread_pot(nthreads, 0.0);
+    vector<int> thread_contact(nthreads, 0);
+
+    #pragma omp parallel
+    {
+    const int t = threadId();
+    int a,b,n; // flat atom indices
+    vector<int> partners;
+    double this_lj, sum_lj=0, sum_pot=0;
+    double r,r2,ir6,sr6,sr12,d[3];
+    int contact = 0; // a bad contact makes the whole energy 1e40, so the rest of this thread's atoms can be skipped
+
+    #pragma omp for schedule(static, 16)
+    for (a = 0; a < natoms; a++) {
+    if (contact) continue;
+    const int row = system.atoms.type[a]*ntypes;
+    cellPartners(system, a, system.atoms.mol[a]+1, use_cells, partners);
+    if (use_simd) { // vector kernel (simd.cpp)
+        double rmin2;
+        prunePartners(system, a, 0, partners);
+        this_lj = lj_pairs_simd_box<BOX>(system, a, partners.data(), partners.size(), &rmin2);
+        if (auto_reject_option && rmin2 <= auto_reject_r*auto_reject_r) { // auto-reject feature for bad contacts
+            contact = 1;
+            continue;
+        }
+        sum_lj += this_lj;
+        sum_pot += this_lj;
+        continue;
+    }
+    for (n = 0; n < partners.size(); n++) {
+        b = partners[n];
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
 
+        // mixed pair parameters, from the atom type tables
+        const int k = row + system.atoms.type[b];
+        const double eps = mix_eps[k], sig = mix_sig[k];
         if (sig == 0 || eps == 0) continue; // skip 0 energy interactions
 
-        // calculate distance between atoms
-        double* distances = getDistanceXYZ(system, i, j, k, l);
-        r = distances[3];
+        // calculate distance between atoms (squared; 12-6 only needs r^2)
+        r2 = getDistance2<BOX>(system, a, b, d);
 
-        if (auto_reject_option && r <= auto_reject_r) { // auto-reject feature for bad contacts
-            system.constants.auto_reject = 1;
-            system.constants.rejects++;
-            //printf("triggered\n");
-            return 1e40; // a really big energy
+        if (auto_reject_option && r2 <= auto_reject_r*auto_reject_r) { // auto-reject feature for bad contacts
+            contact = 1;
+            break;
         }
-        //r = system.pairs[i][j][k][l].r;    
 
-        sr6 = sig/r; //printf("r=%f\n",r);
-        sr6 *= sr6;
-        sr6 *= sr6*sr6; //;
+        ir6 = 1.0/r2;
+        ir6 *= ir6*ir6;
+        sr6 = mix_sig6[k]*ir6;
+        sr12 = mix_sig12[k]*ir6*ir6;
 
         // ============================ LJ potential =============================
 
         // 1) Normal LJ: only apply if long range corrections are off, or if on and r<cutoff
-        if ((!system.constants.rd_lrc || r <= cutoff)) {
-            this_lj = 4.0*eps*(sr6*sr6 - sr6);
-            total_lj += this_lj;    //;
-            total_pot += this_lj;
-
-            if (system.constants.feynman_hibbs)
-                total_pot += lj_fh_corr(system, i,k, r, sr6*sr6, sr6, sig, eps);
-        }
-        
-        /*
-        // end if recalculate
-        } else {
-            if ((system.constants.rd_lrc=="off" || r <= cutoff)) {
-                this_lj = system.pairs[i][j][k][l].lj;
-                total_lj += this_lj;
-                total_pot += this_lj;
+        if (!(F & LJ_LRC) || r2 <= cutoff*cutoff) {
+            this_lj = 4.0*eps*(sr12 - sr6);
+            sum_lj += this_lj;    //;
+            sum_pot += this_lj;
+
+            if (F & LJ_FH) {
+                r = sqrt(r2);
+                sum_pot += lj_fh_corr(system, system.atoms.mol[a], system.atoms.mol[b], r, sr12, sr6, sig, eps);
             }
         }
-        */
-    }  // loop l
-    } // loop k 
-    } //loop j
-    } // loop i
+    }  // loop partners b
+    } // loop a
 
+    thread_lj[t] = sum_lj;
+    thread_pot[t] = sum_pot;
+    thread_contact[t] = contact;
+    } // end parallel region
+
+    for (int t=0; t<nthreads; t++) {
+        if (thread_contact[t]) {
+            system.constants.auto_reject = 1;
+            system.constants.rejects++;
+            //printf("triggered\n");
+            return 1e40; // a really big energy
+        }
+    }
+    total_lj = sumThreads(thread_lj);
+    total_pot = sumThreads(thread_pot);
+    } // end if fused
 
     // 2) Long range corr.: apply RD long range correction if needed
         // http://www.seas.upenn.edu/~amyers/MolPhys.pdf
-    if (system.constants.rd_lrc) {
-        if (system.stats.MCstep == 0 || system.constants.ensemble == ENSEMBLE_NPT || system.constants.ensemble == ENSEMBLE_UVT) { // lrc only changes if volume or N changes.
-        for (i=0; i < system.molecules.size(); i++) {
-        for (j=0; j< system.molecules[i].atoms.size(); j++) {
-        for (k=0; k <system.molecules.size(); k++) {
-        for (l=0; l <system.molecules[k].atoms.size(); l++) {
-
-        if (system.molecules[i].frozen && system.molecules[k].frozen) continue; // skip frozens
-        if (i<k || (i==k && j<l)) {
-
-        // do mixing rules
-        double eps = system.molecules[i].atoms[j].eps,sig=system.molecules[i].atoms[j].sig;
-        if (eps != system.molecules[k].atoms[l].eps)
-            eps = sqrt(eps * system.molecules[k].atoms[l].eps);
-        if (sig != system.molecules[k].atoms[l].sig)
-         sig = 0.5 * (sig + system.molecules[k].atoms[l].sig);
-        if (sig == 0 || eps == 0) continue; // skip 0 energy interactions         
-
-            double sig3 = fabs(sig);
-            sig3 *= sig3*sig3;
-            double sigcut = fabs(sig)/cutoff;
-            double sigcut3 = sigcut * sigcut * sigcut;
-            double sigcut9 = sigcut3 * sigcut3 * sigcut3;
-
-            double this_rd_lrc = (16.0/3.0)*M_PI*eps*sig3*((1.0/3.0)*sigcut9 - sigcut3)/volume;
-            total_rd_lrc += this_rd_lrc;
-            total_pot += this_rd_lrc;
-        } // pair condition
-        }
-        }
-        }
-        } // end 4 atom loops.
-        } // end if recalculate lrc
-        else {
-           total_rd_lrc = system.stats.lj_lrc.value;
-           total_pot += total_rd_lrc;
-        }
+    if (F & LJ_LRC) {
+        total_rd_lrc = lj_lrc(system);
+        total_pot += total_rd_lrc;
     } // end if RD LRC is on
     // DONE WITH PAIR INTERACTIONS
 
     // 3) LJ LRC self energy
     // only do for individual non-frozen atoms
-    if (system.constants.rd_lrc) {  
+    if (F & LJ_LRC) {  
         total_rd_self_lrc = self_lj_lrc(system);
         total_pot += total_rd_self_lrc;
     } // end LRC self contribution.
@@ -212,33 +233,131 @@ double lj(System &system) {
 
 }
 
+double lj(System &system) {
+    return system.kernels.lj(system);
+}
+
+
+// LJ (+FH) of one molecule with the rest of the system (for MC energy differences)
+// check_contacts=0 skips the auto-reject test, e.g. for the pre-move configuration
+template <int BOX, int F>
+double lj_molecule_box(System &system, int molid, int check_contacts) {
+    double total_pot=0;
+    const double cutoff = system.pbc.cutoff;
+    int a,b,n;
+    vector<int> &partners = system.atoms.partners;
+    const int_fast8_t use_cells = (F & LJ_LRC) != 0; // cells only cover the cutoff
+    double r,r2,ir6,sr6,sr12,d[3];
+    const double auto_reject_r = system.constants.auto_reject_r;
+    const int auto_reject_option = (F & LJ_REJECT) && check_contacts;
+    const int_fast8_t use_simd = system.constants.simd_option && !(F & LJ_FH);
+    const int ntypes = system.atomtypes.n;
+    const double *mix_eps = &system.atomtypes.mix_eps[0], *mix_sig = &system.atomtypes.mix_sig[0];
+    const double *mix_sig6 = &system.atomtypes.mix_sig6[0], *mix_sig12 = &system.atomtypes.mix_sig12[0];
+
+    for (a = system.atoms.start[molid]; a < system.atoms.start[molid+1]; a++) {
+    const int row = system.atoms.type[a]*ntypes;
+    cellPartners(system, a, 0, use_cells, partners);
+    if (use_simd) { // vector kernel (simd.cpp)
+        double rmin2;
+        prunePartners(system, a, 0, partners);
+        total_pot += lj_pairs_simd_box<BOX>(system, a, partners.data(), partners.size(), &rmin2);
+        if (auto_reject_option && rmin2 <= auto_reject_r*auto_reject_r) { // auto-reject feature for bad contacts
+            system.constants.auto_reject = 1;
+            system.constants.rejects++;
+            return 1e40;
+        }
+        continue;
+    }
+    for (n = 0; n < partners.size(); n++) {
+        b = partners[n];
+        if (system.constants.fgrid_option && system.atoms.frozen[a] != system.atoms.frozen[b]) continue; // framework is on the grid
+
+        // mixed pair parameters, from the atom type tables
+        const int k = row + system.atoms.type[b];
+        const double eps = mix_eps[k], sig = mix_sig[k];
+        if (sig == 0 || eps == 0) continue; // skip 0 energy interactions
+
+        r2 = getDistance2<BOX>(system, a, b, d);
+
+        if (auto_reject_option && r2 <= auto_reject_r*auto_reject_r) { // auto-reject feature for bad contacts
+            system.constants.auto_reject = 1;
+            system.constants.rejects++;
+            return 1e40;
+        }
+
+        ir6 = 1.0/r2;
+        ir6 *= ir6*ir6;
+        sr6 = mix_sig6[k]*ir6;
+        sr12 = mix_sig12[k]*ir6*ir6;
+
+        if (!(F & LJ_LRC) || r2 <= cutoff*cutoff) {
+            total_pot += 4.0*eps*(sr12 - sr6);
+
+            if (F & LJ_FH) {
+                r = sqrt(r2);
+                total_pot += lj_fh_corr(system, molid, system.atoms.mol[b], r, sr12, sr6, sig, eps);
+            }
+        }
+    } // loop partners b
+    } // loop a
+
+    return total_pot;
+}
+
+double lj_molecule(System &system, int molid, int check_contacts) {
+    return system.kernels.lj_molecule(system, molid, check_contacts);
+}
 
 void lj_force(System &system) {
+    // flat atom arrays are made in calculateForces()
+    const int natoms = system.atoms.x.size();
+    vector<double> thread_f(threadCount()*4*natoms, 0.0); // see addThreadForces()
+
+    if (system.constants.simd_option) { // vector kernel (simd.cpp) on the flat atom arrays
+        #pragma omp parallel
+        {
+        double *tf = &thread_f[threadId()*4*natoms];
+        #pragma omp for schedule(static, 16)
+        for (int a = 0; a < natoms; a++)
+            lj_force_range_simd(system, a, system.atoms.start[system.atoms.mol[a]+1], natoms, tf, tf+natoms, tf+2*natoms);
+        }
+        addThreadForces(system, thread_f);
+        return;
+    }
 
     const double cutoff = system.pbc.cutoff;
-    double d[3], eps, sig, r,rsq,r6,s2,s6, f[3]; //, sr, sr2, sr6;
+    #pragma omp parallel
+    {
+    double *tf = &thread_f[threadId()*4*natoms];
+    double d[3], eps, sig, r,rsq,r6,s6,s12, f[3]; //, sr, sr2, sr6;
     //int count=0; // for the pair values
     //int index=0;
+    #pragma omp for schedule(static, 1)
     for (int i = 0; i < system.molecules.size(); i++) {
     for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
+    const int a = system.atoms.start[i]+j;
     for (int k = i+1; k < system.molecules.size(); k++) {
     for (int l =0; l < system.molecules[k].atoms.size(); l++) {
+        const int b = system.atoms.start[k]+l;
 
-        // do mixing rules
-        eps = sqrt(system.molecules[i].atoms[j].eps * system.molecules[k].atoms[l].eps);
-        sig = 0.5 * (system.molecules[i].atoms[j].sig + system.molecules[k].atoms[l].sig);
+        // mixed pair parameters, from the atom type tables
+        const int t = system.atoms.type[a]*system.atomtypes.n + system.atoms.type[b];
+        eps = system.atomtypes.mix_eps[t];
+        sig = system.atomtypes.mix_sig[t];
 
         if (!(sig == 0 || eps == 0)) {
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system, i, j, k, l);
+        double distances[4];
+        getDistanceXYZ(system, i, j, k, l, distances);
         r = distances[3];    
         //printf("r[%i] = %f\n",index, r);
         rsq=r*r;
         for (int n=0; n<3; n++) d[n] = distances[n];
 
         r6 = rsq*rsq*rsq;
-        s2 = sig*sig;
-        s6 = s2*s2*s2;
+        s6 = system.atomtypes.mix_sig6[t];
+        s12 = system.atomtypes.mix_sig12[t];
                 /*
                 if (i != k) { // don't do self-interaction for potential.
                     sr = sig/r;
@@ -249,9 +368,9 @@ void lj_force(System &system) {
             
         if ((!system.constants.rd_lrc || r <= cutoff)) {
             for (int n=0; n<3; n++) {
-                f[n] = 24.0*d[n]*eps*(2*(s6*s6)/(r6*r6*rsq) - s6/(r6*rsq));
-                system.molecules[i].atoms[j].force[n] += f[n];
-                system.molecules[k].atoms[l].force[n] -= f[n];
+                f[n] = 24.0*d[n]*eps*(2*s12/(r6*r6*rsq) - s6/(r6*rsq));
+                tf[n*natoms + a] += f[n];
+                tf[n*natoms + b] -= f[n];
             }
 
 /*
@@ -272,34 +391,45 @@ void lj_force(System &system) {
     } // loop k 
     } //loop j
     } // loop i
+    } // end parallel region
+    addThreadForces(system, thread_f);
     // DONE WITH PAIR INTERACTIONS
 }
 
 void lj_force_nopbc(System &system) {
 
-    double d[3], sr, eps, sig, sr2, sr6, r,rsq,r6,s2,s6, f[3];
+    const int natoms = system.atoms.x.size();
+    vector<double> thread_f(threadCount()*4*natoms, 0.0); // see addThreadForces()
   //  int count=0; // for the pair values
 
+    #pragma omp parallel
+    {
+    double *tf = &thread_f[threadId()*4*natoms];
+    double d[3], sr, eps, sig, sr2, sr6, r,rsq,r6,s6,s12, f[3];
+    #pragma omp for schedule(static, 1)
     for (int i = 0; i < system.molecules.size(); i++) {
     for (int j = 0; j < system.molecules[i].atoms.size(); j++) {
+    const int a = system.atoms.start[i]+j;
     for (int k = i+1; k < system.molecules.size(); k++) {
     for (int l =0; l < system.molecules[k].atoms.size(); l++) {
+        const int b = system.atoms.start[k]+l;
 
-        // do mixing rules
-        //double eps,sig;
-        eps = sqrt(system.molecules[i].atoms[j].eps * system.molecules[k].atoms[l].eps);
-        sig = 0.5 * (system.molecules[i].atoms[j].sig + system.molecules[k].atoms[l].sig);
+        // mixed pair parameters, from the atom type tables
+        const int t = system.atoms.type[a]*system.atomtypes.n + system.atoms.type[b];
+        eps = system.atomtypes.mix_eps[t];
+        sig = system.atomtypes.mix_sig[t];
 
         if (!(sig == 0 || eps == 0)) {
         // calculate distance between atoms
-        double* distances = getDistanceXYZ(system, i, j, k, l);
+        double distances[4];
+        getDistanceXYZ(system, i, j, k, l, distances);
         r = distances[3];    
         rsq=r*r;
         for (int n=0; n<3; n++) d[n] = distances[n];
 
         r6 = rsq*rsq*rsq;
-        s2 = sig*sig;
-        s6 = s2*s2*s2;
+        s6 = system.atomtypes.mix_sig6[t];
+        s12 = system.atomtypes.mix_sig12[t];
     
                 if (i != k) { // don't do self-interaction for potential.
                     sr = sig/r;
@@ -308,16 +438,18 @@ void lj_force_nopbc(System &system) {
                 }
 
             for (int n=0; n<3; n++) {
-                f[n] = 24.0*d[n]*eps*(2*(s6*s6)/(r6*r6*rsq) - s6/(r6*rsq));
-                system.molecules[i].atoms[j].force[n] += f[n];
-                system.molecules[k].atoms[l].force[n] -= f[n];
+                f[n] = 24.0*d[n]*eps*(2*s12/(r6*r6*rsq) - s6/(r6*rsq));
+                tf[n*natoms + a] += f[n];
+                tf[n*natoms + b] -= f[n];
             }
 
-            system.molecules[i].atoms[j].V += 4.0*eps*(sr6*sr6 - sr6);
+            tf[3*natoms + a] += 4.0*eps*(sr6*sr6 - sr6);
         } // if nonzero sig/eps
     }  // loop l
     } // loop k 
     } //loop j
     } // loop i
+    } // end parallel region
+    addThreadForces(system, thread_f);
     // DONE WITH PAIR INTERACTIONS
-}
+}
\ No newline at end of file
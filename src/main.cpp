@@ -65,6 +65,7 @@ int main(int argc, char **argv) {
 	if (system.constants.autocenter)
         centerCoordinates(system);
     setupBox(system);
+    setupPotentialForm(system); // energy/force kernels for this model and these options
     if (system.stats.radial_dist)
         setupRadialDist(system);
     moleculePrintout(system); // this will confirm the sorbate to the user in the output. Also checks for system.constants.model_name and overrides the prototype sorbate accordingly.
@@ -76,8 +77,16 @@ int main(int argc, char **argv) {
     }
     setupFugacity(system);
     initialize(system); // these are just system name sets,
+    if (system.constants.simd_option)
+        setupErfcTable(system); // for the vector Ewald kernel. made once here since the threaded loops only read it
+    if (system.constants.fgrid_option)
+        setupFrameworkGrid(system); // tabulate the framework potential
+    else
+        fgridEfieldOff(system);
     printf("SORBATE COUNT: %i\n", (int)system.proto.size());
     printf("VERSION NUMBER: %i\n", 336); // i.e. github commit
+    printf("PAIR KERNELS: %s\n", system.constants.simd_option ? SIMD_NAME : "scalar loops");
+    printf("OPENMP THREADS: %i\n", threadCount());
     system.checkpoint("Done with system setup functions.");
 
     // compute inital COM for all molecules, and moment of inertia
@@ -87,6 +96,8 @@ int main(int argc, char **argv) {
         if (system.molecules[i].atoms.size() > 1) system.molecules[i].calc_inertia();
         for (int n=0;n<3;n++) system.molecules[i].original_com[n] = system.molecules[i].com[n]; // save original molecule COMs for diffusion calculation in MD.
     }
+    setupRigidBodies(system); // COM + quaternion + site template for the movable molecules
+    setupMovables(system); // per-prototype index of the movable molecules (MC moves)
 
 	// clobber files
 	remove( system.constants.output_traj.c_str() ); remove( system.constants.thermo_output.c_str() );
@@ -137,17 +148,20 @@ int main(int argc, char **argv) {
     int finalstep = system.constants.finalstep;
     int corrtime = system.constants.mc_corrtime; // print output every corrtime steps
 
+    // FLAT ATOM ARRAYS AND LINKED CELLS FOR THE PAIR LOOPS (cells only if the box is big enough)
+    buildAtomArrays(system);
+    if (system.cells.active)
+        printf("Using linked-cell list: %i x %i x %i cells\n", system.cells.dim[0], system.cells.dim[1], system.cells.dim[2]);
+
     // RESIZE A MATRIX IF POLAR IS ACTIVE (and initialize the dipole file)
     if (system.constants.potential_form == POTENTIAL_LJESPOLAR || system.constants.potential_form == POTENTIAL_LJPOLAR || system.constants.potential_form == POTENTIAL_COMMYESPOLAR) {
 				FILE * fp = fopen(system.constants.dipole_output.c_str(), "w");
 				fclose(fp);
 
         system.last.total_atoms = system.constants.total_atoms;
-        int N = 3 * system.constants.total_atoms;
-        system.constants.A_matrix= (double **) calloc(N,sizeof(double*));
-        for (int i=0; i< N; i++ ) {
-            system.constants.A_matrix[i]= (double *) malloc(N*sizeof(double));
-        }
+        if (!system.constants.polar_matrix_free) {
+        amatrix_reserve(system, system.constants.total_atoms);
+        } else printf("Using matrix-free polarization (no A matrix; dipole pairs within the cutoff only)\n");
 
         system.last.thole_total_atoms = system.constants.total_atoms;
 
@@ -189,6 +203,10 @@ int main(int argc, char **argv) {
         // CHECK FOR CORRTIME
         if (t==0 || t % corrtime == 0 || t == finalstep) { /// output every x steps
 
+            // keep the delta-tracked energy honest
+            if (t != 0 && system.constants.delta_energy_option)
+                checkEnergyDrift(system);
+
 			// get all observable averages
             computeAverages(system);
 
@@ -248,6 +266,8 @@ int main(int argc, char **argv) {
                 system.stats.es.average, system.stats.es.sd); //, system.stats.es_real.average, system.stats.es_recip.average, system.stats.es_self.average);
 			printf("Polar avg =           %.5f +- %.5f K\n",system.stats.polar.average, system.stats.polar.sd);
 			printf("Total potential avg = %.5f +- %.5f K\n",system.stats.potential.average, system.stats.potential.sd);
+            if (system.constants.delta_energy_option)
+                printf("Energy drift (delta vs. full) = %e K\n", system.stats.energy_drift);
 			printf("Volume avg  = %.2f +- %.2f A^3 = %.2f nm^3\n",system.stats.volume.average, system.stats.volume.sd, system.stats.volume.average/1000.0);
 			for (int i=0; i<system.proto.size(); i++) {
                 double mmolg = system.stats.wtpME[i].average * 10 / (system.proto[i].mass*1000*system.constants.NA);
@@ -344,12 +364,11 @@ int main(int argc, char **argv) {
         time_elapsed = (std::chrono::duration_cast<std::chrono::microseconds>(end - begin).count()) /1000000.0;
 	printf("Total wall time = %f s\n",time_elapsed);
 
-    if (system.constants.potential_form == POTENTIAL_LJESPOLAR || system.constants.potential_form == POTENTIAL_LJPOLAR) {
+    if ((system.constants.potential_form == POTENTIAL_LJESPOLAR || system.constants.potential_form == POTENTIAL_LJPOLAR) && !system.constants.polar_matrix_free) {
         printf("Freeing data structures... ");
-        for (int i=0; i< 3* system.constants.total_atoms; i++) {
-            free(system.constants.A_matrix[i]);
-        }
-        free(system.constants.A_matrix); system.constants.A_matrix = NULL;
+        aligned_vector().swap(system.constants.A_matrix);
+        aligned_float_vector().swap(system.constants.A_matrix_float);
+        system.constants.A_capacity = 0;
     }
     printf("done.\n");
 	printf("MC steps completed. Exiting program.\n"); std::exit(0);
@@ -148,7 +148,6 @@ double * calculateEnergyAndTemp(System &system, double currtime) { // the * is t
 
 
 void calculateForces(System &system, double dt) {
-  int_fast8_t model = system.constants.potential_form;
 
     // loop through all atoms
 	for (int j=0; j <system.molecules.size(); j++) {
@@ -164,29 +163,8 @@ void calculateForces(System &system, double dt) {
     // GET FORCES
     // CPU style
     if (!system.constants.cuda) {
-        // no pbc
-        if (!system.constants.md_pbc) {
-        if (model == POTENTIAL_LJ || model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR || model == POTENTIAL_LJPOLAR)
-            lj_force_nopbc(system);
-        if (model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR)
-            coulombic_force_nopbc(system);
-        } 
-        // pbc
-        else {
-        if (model == POTENTIAL_LJ || model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR || model == POTENTIAL_LJPOLAR)
-            lj_force(system);
-        if (model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR)
-            coulombic_real_force(system);
-        if (model == POTENTIAL_LJESPOLAR || model == POTENTIAL_LJPOLAR)
-            polarization_force(system);
-            int index=0;
-            //for (int i=0;i<system.molecules.size();i++)
-              //  for (int j=0;j<system.molecules[i].atoms.size();j++){
-                    //printf("H[0] force = %f %f %f\n",system.molecules[0].atoms[0].force[0], system.molecules[0].atoms[0].force[1], system.molecules[0].atoms[0].force[2]);
-                //    index++;
-                //}
-            
-        }
+        buildAtomArrays(system); // flat indices for the per-thread force buffers
+        system.kernels.forces(system); // lj, es and polar forces for this potential form and md_pbc (potential.cpp)
     // GPU style
     } else {
         #ifdef CUDA
@@ -246,35 +224,21 @@ void integrate(System &system, double dt) {
             if (system.constants.md_rotations && system.molecules[j].atoms.size() > 1) {
             system.molecules[j].calc_ang_pos(dt);
 
-            // rotate molecules
-            for (i=0; i<system.molecules[j].atoms.size(); i++) {
-                // ROTATE IN X
-                double* rotatedx = rotatePointRadians(system,
-                system.molecules[j].atoms[i].pos[0] - system.molecules[j].com[0],
-                system.molecules[j].atoms[i].pos[1] - system.molecules[j].com[1],
-                system.molecules[j].atoms[i].pos[2] - system.molecules[j].com[2],
-                0, system.molecules[j].ang_pos[0] );
-                for (n=0; n<3; n++)
-                    system.molecules[j].atoms[i].pos[n] = rotatedx[n] + system.molecules[j].com[n];
-
-                // ROTATE IN Y
-                double* rotatedy = rotatePointRadians(system,
-                system.molecules[j].atoms[i].pos[0] - system.molecules[j].com[0],
-                system.molecules[j].atoms[i].pos[1] - system.molecules[j].com[1],
-                system.molecules[j].atoms[i].pos[2] - system.molecules[j].com[2],
-                1, system.molecules[j].ang_pos[1] );
-                for (n=0; n<3; n++)
-                    system.molecules[j].atoms[i].pos[n] = rotatedy[n] + system.molecules[j].com[n];
-
-                // ROTATE IN Z
-                double* rotatedz = rotatePointRadians(system,
-                system.molecules[j].atoms[i].pos[0] - system.molecules[j].com[0],
-                system.molecules[j].atoms[i].pos[1] - system.molecules[j].com[1],
-                system.molecules[j].atoms[i].pos[2] - system.molecules[j].com[2],
-                2, system.molecules[j].ang_pos[2] );
-                for (n=0; n<3; n++)
-                    system.molecules[j].atoms[i].pos[n] = rotatedz[n] + system.molecules[j].com[n];
-            } // end loop over atoms i
+            // rotate molecules: x, then y, then z by ang_pos about the COM, as one quaternion
+            // product; the sites are then regenerated from com and q
+            if (system.molecules[j].body >= 0) {
+                const double ux[3] = {1,0,0}, uy[3] = {0,1,0}, uz[3] = {0,0,1};
+                double qx[4], qy[4], qz[4], dq[4], q[4];
+                quatAxisAngle(ux, system.molecules[j].ang_pos[0], qx);
+                quatAxisAngle(uy, system.molecules[j].ang_pos[1], qy);
+                quatAxisAngle(uz, system.molecules[j].ang_pos[2], qz);
+                quatMultiply(qy, qx, q);
+                quatMultiply(qz, q, dq);
+                quatMultiply(dq, system.molecules[j].q, q);
+                quatNormalize(q);
+                for (n=0; n<4; n++) system.molecules[j].q[n] = q[n];
+                rigidBodyPlace(system, j);
+            }
             } // end if rotations allowed and >1 atom
             } // end if movable molecule
         } // end for molecules j
@@ -37,50 +37,35 @@ void translate(System &system, int molid) {
 			}
 } // end translate()
 
+// uniformly random orientation (Shoemake's method)
+void randomQuaternion(double *q) {
+    const double u1 = getrand(), u2 = 2.0*M_PI*getrand(), u3 = 2.0*M_PI*getrand();
+    q[0] = sqrt(1.0-u1)*sin(u2);
+    q[1] = sqrt(1.0-u1)*cos(u2);
+    q[2] = sqrt(u1)*sin(u3);
+    q[3] = sqrt(u1)*cos(u3);
+}
+
+// turn a rigid molecule about its COM: a random axis (uniform on the sphere) and an angle
+// uniform in +-rotate_angle_factor/2 degrees, so the trial move is its own reverse
 void rotate(System &system, int molid) {
     system.checkpoint("doing a rotation move.");
-        double com[3];
-
-        // 1) GET RANDOM ANGLE AND PLANE OF ROTATION.
-        double randangle; int plane;
-		randangle = system.constants.rotate_angle_factor*((double)rand()/(double)RAND_MAX); // angle of rotation from 0 -> rotate_angle_factor
-		double randxyz = (double)rand()/(double)RAND_MAX;
-		// 1/3 change for a given plane
-		if (randxyz < 0.33333) {
-			plane=0;
-		} else if (randxyz < 0.66667) {
-			plane=1;
-		} else { plane=2;}
-
-        // 2) SAVE CURRENT COM
-        for (int n=0; n<3; n++) com[n] = system.molecules[molid].com[n];
-
-        // 3) MOVE MOLECULE TO ORIGIN TEMPORARILY
-        for (int i=0; i<system.molecules[molid].atoms.size(); i++) {
-            for (int n=0; n<3; n++) {
-                system.molecules[molid].atoms[i].pos[n] -= com[n];
-                //printf("com[%i]: %f\n", n,system.molecules[molid].com[n]);
-            }
-        }
-
-        // 4) ROTATE THE MOLECULE ABOUT ORIGIN
-		for (int i=0; i<system.molecules[molid].atoms.size(); i++) {
-				double* rotated = rotatePoint(system, system.molecules[molid].atoms[i].pos[0], system.molecules[molid].atoms[i].pos[1], system.molecules[molid].atoms[i].pos[2], plane, randangle);
-				system.molecules[molid].atoms[i].pos[0] = rotated[0];
-				system.molecules[molid].atoms[i].pos[1] = rotated[1];
-				system.molecules[molid].atoms[i].pos[2] = rotated[2];
-		} // end for i
-
-        // 5) MOVE MOLECULE BACK TO COM POSITION, BUT ROTATED
-        for (int i=0; i<system.molecules[molid].atoms.size(); i++)
-            for (int n=0; n<3; n++)
-                system.molecules[molid].atoms[i].pos[n] += com[n];
-
+    Molecule &mol = system.molecules[molid];
+    if (mol.body < 0) return; // single site
+    double u[3], dq[4], q[4];
+    const double cz = 2.0*getrand() - 1.0, phi = 2.0*M_PI*getrand(), sz = sqrt(1.0 - cz*cz);
+    u[0] = sz*cos(phi); u[1] = sz*sin(phi); u[2] = cz;
+    quatAxisAngle(u, system.constants.rotate_angle_factor*(getrand() - 0.5)*M_PI/180.0, dq);
+    quatMultiply(dq, mol.q, q);
+    quatNormalize(q);
+    for (int p=0; p<4; p++) mol.q[p] = q[p];
+    rigidBodyPlace(system, molid);
 } // end rotate();
 
 
 /* (RE)DEFINE THE BOX LENGTHS */
 void defineBox(System &system) { // takes input in A
+    system.constants.frozen_generation++; // the frozen-frozen A matrix blocks depend on the box
 	// easy 90 90 90 systems
 	if (system.pbc.alpha == 90 && system.pbc.beta == 90 && system.pbc.gamma == 90) {
 		// assumes x_length, y_length, z_length are defined already in system.
@@ -101,6 +86,7 @@ void defineBox(System &system) { // takes input in A
         system.pbc.calcRecip();
         system.pbc.calcCutoff();
 		system.constants.ewald_alpha = 3.5/system.pbc.cutoff; // update ewald_alpha if we have a vol change
+        coulombic_kvectors(system); // k vectors follow the cell
         // no need for vertices and planes for 90/90/90
 
     }
@@ -111,6 +97,7 @@ void defineBox(System &system) { // takes input in A
 		system.pbc.calcRecip();
 		system.pbc.calcCutoff();
 		system.constants.ewald_alpha = 3.5/system.pbc.cutoff;
+        coulombic_kvectors(system);
         system.pbc.calcBoxVertices();
 		system.pbc.calcPlanes();
 	}
@@ -143,6 +130,15 @@ void changeVolumeMove(System &system) {
     defineBox(system);
     //printf("defineBox NEW VOL (should match): %f\n", system.pbc.volume);
 
+    // a cutoff from the input must stay inside minimum image; a trial box too small for it is rejected
+    if (system.pbc.cutoff_fixed && system.constants.all_pbc && system.pbc.cutoff > system.pbc.max_cutoff*(1.0 + 1e-10)) {
+        system.pbc.x_length /= basis_scale_factor;
+        system.pbc.y_length /= basis_scale_factor;
+        system.pbc.z_length /= basis_scale_factor;
+        defineBox(system);
+        return;
+    }
+
     // scale molecule positions
     for (i=0; i<system.molecules.size(); i++) {
         for (n=0; n<3; n++) {
@@ -160,6 +156,7 @@ void changeVolumeMove(System &system) {
         system.molecules[i].calc_center_of_mass();
 //        checkInTheBox(system, i);
     }
+    buildAtomArrays(system); // every position and the cells changed with the box
 
         new_energy=getTotalPotential(system);
 
@@ -196,12 +193,107 @@ void changeVolumeMove(System &system) {
             system.molecules[i].calc_center_of_mass();
   //          checkInTheBox(system,i);
         }
+        buildAtomArrays(system);
 	}
 }
 
 
 
 
+/* MOLECULE STORE
+The movable molecules are indexed per prototype in system.movables (setupMovables()).
+A removed molecule is swapped with the last one in system.molecules, so nothing else
+moves, and is parked in system.spares: a rejected remove puts it back as it was, and
+an insert copies its prototype over a spare instead of allocating a new molecule. */
+
+// a random movable molecule, uniform over all of them
+int randomMovable(System &system) {
+    int r = rand() % (int)(system.stats.count_movables);
+    for (int p=0; p<system.movables.size(); p++) {
+        if (r < system.movables[p].size()) return system.movables[p][r];
+        r -= system.movables[p].size();
+    }
+    printf("ERROR: %i movable molecules counted but only %i indexed.\n", system.stats.count_movables, system.stats.count_movables - r);
+    exit(1);
+}
+
+// put molecule molid in (and take it out of) its movable list
+void movablesAdd(System &system, int molid) {
+    vector<int> &list = system.movables[movableList(system, system.molecules[molid].protoid)];
+    system.molecules[molid].slot = list.size();
+    list.push_back(molid);
+}
+void movablesRemove(System &system, int molid) {
+    vector<int> &list = system.movables[movableList(system, system.molecules[molid].protoid)];
+    const int slot = system.molecules[molid].slot;
+    list[slot] = list.back();
+    system.molecules[list[slot]].slot = slot;
+    list.pop_back();
+    system.molecules[molid].slot = -1;
+}
+
+// append a copy of prototype protoid to the system (atom arrays not included)
+void newMolecule(System &system, int protoid) {
+    vector<Molecule> &spare = system.spares[protoid];
+    if (spare.empty())
+        system.molecules.push_back(system.proto[protoid]);
+    else {
+        system.molecules.push_back(std::move(spare.back()));
+        spare.pop_back();
+        system.molecules.back() = system.proto[protoid]; // same sizes, so this reuses the storage
+    }
+    movablesAdd(system, (int)system.molecules.size()-1);
+}
+
+// take movable molecule molid out of the system, atom arrays and all, and park it in system.spares.
+// the last molecule takes its place. if their atom counts differ, molid first trades places with
+// the last movable of its own size, and only the molecules after that one shift down: the run
+// of other sizes at the end, a few molecules on average however big the system is
+void takeOutMolecule(System &system, int molid) {
+    const int last = (int)system.molecules.size()-1;
+    movablesRemove(system, molid);
+    const int n = system.molecules[molid].atoms.size();
+    int m = last;
+    while (m > molid && (system.molecules[m].frozen || system.molecules[m].atoms.size() != n)) m--;
+    if (m != molid && m != last) {
+        atomArraysSwapMolecules(system, molid, m);
+        std::swap(system.molecules[molid], system.molecules[m]);
+        system.movables[movableList(system, system.molecules[molid].protoid)][system.molecules[molid].slot] = molid;
+        molid = m;
+    }
+    if (molid == last)
+        atomArraysRemoveMolecule(system, molid);
+    else if (system.molecules[molid].atoms.size() == system.molecules[last].atoms.size()) {
+        atomArraysReplaceWithLast(system, molid);
+        std::swap(system.molecules[molid], system.molecules[last]);
+        if (!system.molecules[molid].frozen)
+            system.movables[movableList(system, system.molecules[molid].protoid)][system.molecules[molid].slot] = molid;
+        else
+            system.constants.frozen_generation++; // its atoms have new indices
+    } else {
+        atomArraysEraseMolecule(system, molid);
+        std::rotate(system.molecules.begin()+molid, system.molecules.begin()+molid+1, system.molecules.end());
+        for (int i=molid; i<last; i++) {
+            if (!system.molecules[i].frozen)
+                system.movables[movableList(system, system.molecules[i].protoid)][system.molecules[i].slot] = i;
+            else
+                system.constants.frozen_generation++;
+        }
+    }
+    system.spares[movableList(system, system.molecules[last].protoid)].push_back(std::move(system.molecules[last]));
+    system.molecules.pop_back();
+}
+
+// undo takeOutMolecule() (the last molecule parked in that list) by appending it again
+void putBackMolecule(System &system, int list) {
+    system.molecules.push_back(std::move(system.spares[list].back()));
+    system.spares[list].pop_back();
+    const int molid = (int)system.molecules.size()-1;
+    movablesAdd(system, molid);
+    atomArraysAddMolecule(system, molid);
+}
+
+
 /* ADD A MOLECULE */
 void addMolecule(System &system) {
   //int_fast8_t model = system.constants.potential_form;
@@ -219,7 +311,7 @@ void addMolecule(System &system) {
         protoid = (rand() % (int)(system.proto.size()));
         //printf("rand proto id selected: %i\n", protoid);
     }
-    system.molecules.push_back(system.proto[protoid]);
+    newMolecule(system, protoid);
     system.constants.currentprotoid = protoid; // for getting boltz factor later.
 	system.stats.count_movables += 1;
 
@@ -259,15 +351,27 @@ void addMolecule(System &system) {
         for (int n=0; n<3; n++)
 		    system.molecules[last_molecule_id].atoms[i].pos[n] += move[n];
 	}
+    for (int n=0; n<3; n++) system.molecules[last_molecule_id].com[n] += move[n];
 
-	// rotate the molecule here by random amount.
-    rotate(system, last_molecule_id);
+	// give it a random orientation (nothing to turn for a single site).
+    if (system.molecules[last_molecule_id].body >= 0) {
+        randomQuaternion(system.molecules[last_molecule_id].q);
+        rigidBodyPlace(system, last_molecule_id);
+    }
 
     // **IMPORTANT: MAKE SURE THE MOLECULE IS IN THE BOX**
     checkInTheBox(system, last_molecule_id);
+    atomArraysAddMolecule(system, last_molecule_id);
 
 	// FULLY DONE ADDING MOLECULE TO SYSTEM IN PLACE. NOW GET NEW ENERGY
-	double new_potential = getTotalPotential(system);
+    double new_potential;
+    if (system.constants.delta_energy_option) {
+        double old_mol[3] = {0,0,0}, new_mol[3]; // the molecule had no interactions before
+        getMoleculePotential(system, last_molecule_id, new_mol, 1);
+        new_potential = getMovePotential(system, old_mol, new_mol);
+    } else {
+        new_potential = getTotalPotential(system);
+    }
 
 	// BOLTZMANN ACCEPT OR REJECT
     double boltz_factor = get_boltzmann_factor(system, old_potential, new_potential, MOVETYPE_INSERT);
@@ -279,8 +383,8 @@ void addMolecule(System &system) {
         printEnergies(system);
     } else {
         system.constants.iter_success = 0;
-		// remove the new molecule.
-		system.molecules.pop_back();
+		// remove the new molecule (its storage is kept for the next insert).
+        takeOutMolecule(system, last_molecule_id);
 		system.constants.total_atoms -= (int)system.proto[protoid].atoms.size();
 		system.stats.count_movables--;
 	}
@@ -306,28 +410,33 @@ void removeMolecule(System &system) {
 
     system.checkpoint("getting random movable.");
     // select random movable molecule
-    int_fast8_t frozen = 1;
-    int randm = -1;
-    while (frozen != 0) {
-            randm = (rand() % (int)(system.stats.count_movables)) + (int)system.stats.count_frozen_molecules;
-          //  printf("randm: %i\n",randm);
-            frozen = system.molecules[randm].frozen;
-    }
+    const int randm = randomMovable(system);
     //printf("The molecule id to be deleted is %i\n",randm);
     system.checkpoint("random movable selected.");
+    const int list = movableList(system, system.molecules[randm].protoid);
+    const int natoms = system.molecules[randm].atoms.size();
+    if (system.molecules[randm].protoid >= 0) system.constants.currentprotoid = system.molecules[randm].protoid; // its fugacity
 
-    // save a copy of this moleucule.
-    Molecule tmp_molecule = system.molecules[randm];
+    // its interactions, which go away with it
+    double old_mol[3], new_mol[3] = {0,0,0};
+    if (system.constants.delta_energy_option)
+        getMoleculePotential(system, randm, old_mol, 0);
 
-    // delete the molecule
-    system.molecules.erase(system.molecules.begin() + randm);
+    // delete the molecule (kept aside in system.spares in case the move is rejected)
+    takeOutMolecule(system, randm);
     system.stats.count_movables--;
-    system.constants.total_atoms -= tmp_molecule.atoms.size(); //(int)system.proto[protoid].atoms.size();
+    system.constants.total_atoms -= natoms; //(int)system.proto[protoid].atoms.size();
 
     //make_pairs(system); // recompute pairs for new energy calc.
 
     // get new energy
-    double new_potential = getTotalPotential(system);
+    double new_potential;
+    if (system.constants.delta_energy_option) {
+        system.constants.auto_reject = 0;
+        new_potential = getMovePotential(system, old_mol, new_mol);
+    } else {
+        new_potential = getTotalPotential(system);
+    }
     //double energy_delta = (new_potential - old_potential);
 
     //printf("doing boltzmann -- ");
@@ -345,8 +454,8 @@ void removeMolecule(System &system) {
         system.constants.iter_success = 0;
 	    //printf("rejected remove.\n");
 	    // put the molecule back.
-	    system.molecules.push_back(tmp_molecule);
-        system.constants.total_atoms += tmp_molecule.atoms.size(); //(int)system.proto.atoms.size();
+        putBackMolecule(system, list);
+        system.constants.total_atoms += natoms; //(int)system.proto.atoms.size();
 	    system.stats.count_movables++;
 	}	 // end boltz accept/reject
 return;
@@ -360,13 +469,7 @@ void displaceMolecule(System &system) {
 
     if (system.stats.count_movables == 0) return; // skip if no sorbate molecules are in the cell.
     system.stats.displace_attempts++;
-    int_fast8_t frozen=1;
-    int randm = -1;
-    while (frozen != 0) {
-            randm = (rand() % (int)(system.stats.count_movables)) + (int)system.stats.count_frozen_molecules;
-            //printf("randm: %i\n",randm);
-            frozen = system.molecules[randm].frozen;
-    }
+    const int randm = randomMovable(system);
 	system.checkpoint("Got the random molecule.");
 
     for (int n=0; n<3; n++) tmpcom[n] = system.molecules[randm].com[n];
@@ -377,8 +480,16 @@ void displaceMolecule(System &system) {
 		old_V = system.stats.potential.value; //getTotalPotential(system);
     //    printf("DISPLACE stats pot %f calcd pot %f\n", old_V, getTotalPotential(system));
 
-    // save a temporary copy of molecule to go back if needed
-    Molecule tmp_molecule = system.molecules[randm];
+    // save the rigid-body state to go back to if needed: tmpcom above, the orientation
+    // and the diffusion correction checkInTheBox() may add to
+    double tmp_q[4], tmp_diffusion_corr[3];
+    for (int n=0; n<4; n++) tmp_q[n] = system.molecules[randm].q[n];
+    for (int n=0; n<3; n++) tmp_diffusion_corr[n] = system.molecules[randm].diffusion_corr[n];
+
+    // interactions of the molecule before it moves
+    double old_mol[3], new_mol[3];
+    if (system.constants.delta_energy_option)
+        getMoleculePotential(system, randm, old_mol, 0);
 
 	// do rotation AND translation
     // TRANSLATE
@@ -390,7 +501,7 @@ void displaceMolecule(System &system) {
             printf("H %f %f %f \n", system.molecules[randm].atoms[n].pos[0], system.molecules[randm].atoms[n].pos[1], system.molecules[randm].atoms[n].pos[2]);
 */
     // ROTATION
-    if (system.molecules[randm].atoms.size() > 1 && system.constants.rotate_option) { // try rotation
+    if (system.molecules[randm].body >= 0 && system.constants.rotate_option) { // try rotation
         rotate(system, randm);
     } // end rotation option
 /*
@@ -401,8 +512,14 @@ void displaceMolecule(System &system) {
 
 	// check P.B.C. (move the molecule back in the box if needed)
     checkInTheBox(system, randm);
+    atomArraysUpdateMolecule(system, randm);
 
-                new_V = getTotalPotential(system);
+    if (system.constants.delta_energy_option) {
+        getMoleculePotential(system, randm, new_mol, 1);
+        new_V = getMovePotential(system, old_mol, new_mol);
+    } else {
+        new_V = getTotalPotential(system);
+    }
 
 	// now accept or reject the move based on Boltzmann probability
 	double boltzmann_factor = get_boltzmann_factor(system, old_V, new_V, MOVETYPE_DISPLACE);
@@ -425,13 +542,17 @@ void displaceMolecule(System &system) {
 	} // end accept
 	else {
         system.constants.iter_success =0;
-		// reject for whole molecule
-		for (int i=0; i<system.molecules[randm].atoms.size(); i++) {
-            for (int n=0; n<3; n++) {
-                system.molecules[randm].atoms[i].pos[n] = tmp_molecule.atoms[i].pos[n];
-            }
-		}
-        system.molecules[randm].calc_center_of_mass();
+		// reject for whole molecule: back to the old com and q (a single site is its com)
+        for (int n=0; n<3; n++) {
+            system.molecules[randm].com[n] = tmpcom[n];
+            system.molecules[randm].diffusion_corr[n] = tmp_diffusion_corr[n];
+        }
+        for (int n=0; n<4; n++) system.molecules[randm].q[n] = tmp_q[n];
+        if (system.molecules[randm].body >= 0)
+            rigidBodyPlace(system, randm);
+        else
+            for (int n=0; n<3; n++) system.molecules[randm].atoms[0].pos[n] = tmpcom[n];
+        atomArraysUpdateMolecule(system, randm);
         // check P.B.C. (move the molecule back in the box if needed)
         //checkInTheBox(system, randm);
 	} // end reject
@@ -32,7 +32,8 @@ void make_pairs(System &system) {
                 for (l=0; l<system.molecules[k].atoms.size(); l++) {
                     if (i==k && j==l) continue; // always skip self-atom distance
                     if (system.molecules[i].frozen && system.molecules[k].frozen) continue; // I don't think I ever use frozen-pair distances.    
-                    double *distances = getDistanceXYZ(system, i,j,k,l);
+                    double distances[4];
+                    getDistanceXYZ(system, i,j,k,l, distances);
                     double r = distances[3];
                     system.pairs[i][j][k][l].r = r;
                     for (p=0; p<3; p++) system.pairs[i][j][k][l].d[p] = distances[p];                    
@@ -44,12 +44,54 @@ void print_matrix(System &system, int N, double **matrix) {
     printf("\n");
 }
 
-void zero_out_amatrix(System &system, int N) {
-    int i,j;
-    for (i=0; i<3*N; i++)
-        for (j=0; j<3*N; j++)
-            system.constants.A_matrix[i][j] = 0;
-    return;
+/* The A matrix is one aligned allocation of 3x3 blocks, A_capacity x A_capacity of them.
+Row i of blocks (atom i against every atom j) is contiguous, so a contraction streams
+through it. Only the top-left N x N blocks are in use. */
+
+// make room for natoms atoms. the capacity grows by at least 25% at a time and never
+// shrinks, so uVT inserts and removes seldom reallocate
+void amatrix_reserve(System &system, int natoms) {
+    if (natoms <= system.constants.A_capacity) return;
+    int capacity = system.constants.A_capacity + system.constants.A_capacity/4;
+    if (capacity < natoms) capacity = natoms;
+    system.constants.A_capacity = capacity;
+
+    // free the old one first; its contents are rebuilt by thole_amatrix() anyway
+    system.constants.frozen_generation++;
+    const size_t size = 9*(size_t)capacity*capacity;
+    if (system.constants.polar_float_matrix) {
+        aligned_float_vector().swap(system.constants.A_matrix_float);
+        system.constants.A_matrix_float.resize(size);
+    } else {
+        aligned_vector().swap(system.constants.A_matrix);
+        system.constants.A_matrix.resize(size);
+    }
+}
+
+// are the frozen-frozen blocks left in the A matrix by the last thole_amatrix() still right?
+// they are if nothing has bumped frozen_generation since (frozen atoms don't move).
+// remembers the current generation for next time either way.
+int amatrix_frozen_cached(System &system) {
+    const int same = system.constants.polar_frozen_cache && system.constants.amatrix_frozen_generation == system.constants.frozen_generation;
+    system.constants.amatrix_frozen_generation = system.constants.frozen_generation;
+    return same;
+}
+
+// offset of the 3x3 block (i,j)
+inline size_t amatrix_block(System &system, int i, int j) {
+    return 9*((size_t)i*system.constants.A_capacity + j);
+}
+
+// write block (i,j) in whichever precision the matrix is kept
+inline void amatrix_set(System &system, int i, int j, double block[3][3]) {
+    const size_t b = amatrix_block(system, i, j);
+    for (int p=0; p<3; p++)
+        for (int q=0; q<3; q++) {
+            if (system.constants.polar_float_matrix)
+                system.constants.A_matrix_float[b+3*p+q] = (float)block[p][q];
+            else
+                system.constants.A_matrix[b+3*p+q] = block[p][q];
+        }
 }
 
 double get_dipole_rrms (System &system) {
@@ -71,9 +113,9 @@ double get_dipole_rrms (System &system) {
 /* for uvt runs, resize the A matrix */
 void thole_resize_matrices(System &system) {
 
-    int i, N, dN, oldN;
+    int N, dN, oldN;
 
-    /* determine how the number of atoms has changed and realloc matrices */
+    /* determine how the number of atoms has changed and grow the matrix */
     oldN = 3*system.last.thole_total_atoms; //will be set to zero if first time called
     system.last.thole_total_atoms = system.constants.total_atoms;
     N = 3*system.last.thole_total_atoms;
@@ -88,28 +130,31 @@ void thole_resize_matrices(System &system) {
     // re-make the AtomMap if needed
     makeAtomMap(system); // re-calculates unique indices for atoms
 
-    // grow A matricies by free/malloc (to prevent fragmentation)
-    //free the A matrix
-    for (i=0; i < oldN; i++) free(system.constants.A_matrix[i]);
-    free(system.constants.A_matrix);
-
+    // grow the A matrix if it has run out of room (see amatrix_reserve())
+    amatrix_reserve(system, system.constants.total_atoms);
 
-    //(RE)allocate the A matrix
-    system.constants.A_matrix= (double **) calloc(N,sizeof(double*));
-//    memnullcheck(system.constants.A_matrix,N*sizeof(double*), __LINE__-1, __FILE__);
+     return;
+}
 
-    for (i=0; i< N; i++ ) {
-        system.constants.A_matrix[i]= (double *) malloc(N*sizeof(double));
-  //      memnullcheck(system.constants.A_matrix[i],N*sizeof(double), __LINE__-1, __FILE__);
+/* set the diagonal blocks of A: 1/alpha on the diagonal */
+void amatrix_diagonal(System &system, int N) {
+    const double MAXVALUE = 1.0e40;
+    for (int i = 0; i < N; i++) {
+        double block[3][3] = {{0,0,0},{0,0,0},{0,0,0}};
+        for (int p = 0; p < 3; p++) {
+            if (system.atoms.polar[i] != 0.0)
+                block[p][p] = 1.0/system.atoms.polar[i];
+            else
+                block[p][p] = MAXVALUE;
+        }
+        amatrix_set(system, i, i, block);
     }
-
-     return;
 }
 
 /* calculate the dipole field tensor */
 void thole_amatrix(System &system) {
 
-    int i, j, ii, jj, N, p, q;
+    int i, j, N, p, q;
     int w, x, y, z;
     double damp1=0, damp2=0; //, wdamp1=0, wdamp2=0; // v, s; //, distancesp[3], rp;
     double r, r2, ir3, ir5, ir=0;
@@ -124,39 +169,27 @@ void thole_amatrix(System &system) {
     const double MAXVALUE = 1.0e40;
     N = (int)system.constants.total_atoms;
 
-    system.checkpoint("in thole_amatrix() --> zeroing out");
-    zero_out_amatrix(system,N);
-    //print_matrix(system, 3*N, system.constants.A_matrix);
-    system.checkpoint("done with zero_out_amatrix()");
+    amatrix_reserve(system, N);
+    const int cached = amatrix_frozen_cached(system); // if so, skip the pairs of frozen atoms
 
     //system.checkpoint("setting diagonals in A");
-    /* set the diagonal blocks */
-    for(i = 0; i < N; i++) {
-        ii = i*3;
-        w = system.atommap[i][0];
-        x = system.atommap[i][1];
-
-        for(p = 0; p < 3; p++) {
-            if(system.molecules[w].atoms[x].polar != 0.0)
-                system.constants.A_matrix[ii+p][ii+p] = 1.0/system.molecules[w].atoms[x].polar;
-            else
-                system.constants.A_matrix[ii+p][ii+p] = MAXVALUE;
-        }
-    }   
+    amatrix_diagonal(system, N); // every off-diagonal block is written below
     //system.checkpoint("done setting diagonals in A");
    
     //system.checkpoint("starting Tij loop"); 
     /* calculate each Tij tensor component for each dipole pair */
+    // every (i,j) pair writes its own two blocks, so rows can go to different threads
+    #pragma omp parallel for schedule(dynamic, 8) private(j, w, x, y, z, p, q, r, r2, ir3, ir5, ir, explr, damp1, damp2)
     for(i = 0; i < (N - 1); i++) {
-        ii = i*3;
         w = system.atommap[i][0]; x = system.atommap[i][1];
         for(j = (i + 1);  j < N; j++) {
-            jj = j*3;
+            if (cached && system.atoms.frozen[i] && system.atoms.frozen[j]) continue;
             y = system.atommap[j][0]; z = system.atommap[j][1];
 
             //printf("i %i j %i ======= w %i x %i y %i z %i \n",i,j,w,x,y,z);
 
-            double* distances = getDistanceXYZ(system, w,x,y,z);
+            double distances[4];
+            getDistanceXYZ(system, w,x,y,z, distances);
             r = distances[3];
             // this on-the-spot distance calculator works, but the new method
             // below does not work, even though everywhere else, it does...
@@ -187,28 +220,22 @@ void thole_amatrix(System &system) {
 
            // system.checkpoint("buildling tensor.");
             /* build the tensor */
+            double block[3][3];
             for(p = 0; p < 3; p++) {
                 for(q = 0; q < 3; q++) {
 
-                    system.constants.A_matrix[ii+p][jj+q] = -3.0*distances[p]*distances[q]*damp2*ir5;
+                    block[p][q] = -3.0*distances[p]*distances[q]*damp2*ir5;
 
                     /* additional diagonal term */
                     if(p == q) {
-                        system.constants.A_matrix[ii+p][jj+q] += damp1*ir3;
+                        block[p][q] += damp1*ir3;
                     }   
-                    //printf("A[%i][%i] = %f\n", ii+p, jj+q, system.constants.A_matrix[ii+p][jj+q]);
                 }
             }
-            //system.checkpoint("done building tensor. setting lower half.");
-    
-            //printf("\n");
-            /* set the lower half of the tensor component */
-            for(p = 0; p < 3; p++) {
-                for(q = 0; q < 3; q++) {
-                   //printf("setting A_matrix[%i][%i] = A_matrix[%i][%i] = %f at 3*N = %i, i=%i, j=%i\n", jj+p, ii+q, ii+p, jj+q, system.constants.A_matrix[jj+p][ii+q], 3*N,i,j);
-                    system.constants.A_matrix[jj+p][ii+q] = system.constants.A_matrix[ii+p][jj+q];
-                } // end q
-            } // end p
+
+            /* the tensor is symmetric, so block (j,i) is the same as (i,j) */
+            amatrix_set(system, i, j, block);
+            amatrix_set(system, j, i, block);
         } /* end j */
     } /* end i */
     //print_matrix(system, N*3, system.constants.A_matrix);
@@ -216,11 +243,34 @@ void thole_amatrix(System &system) {
     return;
 }
 
-void thole_field(System &system) {
+// the static field on the atoms: the per-thread buffers (3 per flat atom each) summed in
+// thread order, plus the framework's field from the grid at the sorbate sites if that is on
+void thole_field_collect(System &system, const vector<double> &thread_field) {
+    const int natoms = system.atoms.x.size();
+    const int nthreads = thread_field.size()/(3*natoms);
+    for (int i=0; i<system.molecules.size(); i++) {
+        for (int j=0; j<system.molecules[i].atoms.size(); j++) {
+            const int ia = system.atoms.start[i] + j;
+            for (int p=0; p<3; p++) {
+                system.molecules[i].atoms[j].efield[p] = 0;
+                system.molecules[i].atoms[j].efield_self[p] = 0;
+            }
+            for (int t=0; t<nthreads; t++)
+                for (int p=0; p<3; p++)
+                    system.molecules[i].atoms[j].efield[p] += thread_field[t*3*natoms + 3*ia+p];
+            if (system.constants.fgrid_efield && !system.molecules[i].frozen)
+                fgrid_efield_at(system, system.molecules[i].atoms[j].pos, system.molecules[i].atoms[j].efield);
+        }
+    }
+}
+
+template <int BOX>
+void thole_field_box(System &system) {
     // wolf thole field
-    int i,j,k,l,p;
+    int i,p,n,ia,ib; // ia,ib: flat atom indices
+    vector<int> partners;
     const double SMALL_dR = 1e-12;
-    double r, rr; //r and 1/r (reciprocal of r)
+    double r, rr, distances[3]; //r and 1/r (reciprocal of r)
     const double R = system.pbc.cutoff;
     const double rR = 1./R;
     //used for polar_wolf_alpha (aka polar_wolf_damp)
@@ -230,28 +280,32 @@ void thole_field(System &system) {
     double bigmess=0;
 
 
-    // first zero-out field vectors
-    for (i=0; i<system.molecules.size(); i++) {
-        for (j=0; j<system.molecules[i].atoms.size(); j++) {
-            for (p=0; p<3; p++) {
-                system.molecules[i].atoms[j].efield[p] = 0;
-                system.molecules[i].atoms[j].efield_self[p] = 0;
-            }
-        }
-    }
-    
-
-    for(i=0; i<system.molecules.size(); i++) {
-        for(j=0; j<system.molecules[i].atoms.size(); j++) {
-            for(k=i+1; k<system.molecules.size(); k++) { // molecules not allowed to self-polarize
-            for (l=0; l<system.molecules[k].atoms.size(); l++) {
-
-                if ( system.molecules[i].frozen && system.molecules[k].frozen ) continue; //don't let the MOF polarize itself
-
-                double* distances = getDistanceXYZ(system, i,j,k,l);
-                r = distances[3];
-                //r = system.pairs[i][j][k][l].r;
-                //for (int n=0;n<3;n++) distances[n] = system.pairs[i][j][k][l].d[n];
+    // each thread adds into its own field buffer (3 per flat atom); the buffers
+    // are summed onto the atoms in thread order afterwards
+    const int natoms = system.atoms.x.size();
+    const int nthreads = threadCount();
+    vector<double> thread_field(nthreads*3*natoms, 0.0);
+    const int_fast8_t efield_grid = system.constants.fgrid_efield; // framework field at sorbate sites from the grid
+    int_fast8_t grid_a, grid_b;
+
+    #pragma omp parallel private(i, p, n, ia, ib, r, rr, distances, grid_a, grid_b) firstprivate(bigmess, partners)
+    {
+    double *field = &thread_field[threadId()*3*natoms];
+    #pragma omp for schedule(static, 16)
+    for(ia=0; ia<natoms; ia++) {
+            i = system.atoms.mol[ia];
+            cellPartners(system, ia, i+1, 1, partners); // molecules not allowed to self-polarize
+            for (n=0; n<partners.size(); n++) {
+                ib = partners[n];
+
+                if ( system.atoms.frozen[ia] && system.atoms.frozen[ib] ) continue; //don't let the MOF polarize itself
+                // with the field grid the framework's field at a sorbate site is added below; the pair is
+                // still needed for the sorbate's field on the framework site, unless that has no dipole
+                grid_a = efield_grid && !system.atoms.frozen[ia] && system.atoms.frozen[ib];
+                grid_b = efield_grid && system.atoms.frozen[ia] && !system.atoms.frozen[ib];
+                if ((grid_a && system.atoms.polar[ib] == 0) || (grid_b && system.atoms.polar[ia] == 0)) continue;
+
+                r = sqrt(getDistance2<BOX>(system, ia, ib, distances));
 
                 if((r - SMALL_dR  < system.pbc.cutoff) && (r != 0.)) {
                     rr = 1./r;
@@ -264,38 +318,35 @@ void thole_field(System &system) {
                         if ( a == 0 ) {
 
                             // the commented-out charge=0 check here doesn't save time really.
-                            //if (system.molecules[k].atoms[l].C != 0) {
-                                system.molecules[i].atoms[j].efield[p] += 
-                                (system.molecules[k].atoms[l].C)*
+                            if (!grid_a)
+                                field[3*ia+p] += 
+                                (system.atoms.C[ib])*
                                 (rr*rr-rR*rR)*distances[p]*rr;
-                            //}
-                            //if (system.molecules[i].atoms[j].C != 0) {
-                                system.molecules[k].atoms[l].efield[p] -= 
-                                (system.molecules[i].atoms[j].C )*
+                            if (!grid_b)
+                                field[3*ib+p] -= 
+                                (system.atoms.C[ia])*
                                 (rr*rr-rR*rR)*distances[p]*rr;
-                            //}
 
                         } else {
-                            //if (system.molecules[k].atoms[l].C != 0) {
-                                system.molecules[i].atoms[j].efield[p] +=
-                                (system.molecules[k].atoms[l].C )*
+                            if (!grid_a)
+                                field[3*ia+p] +=
+                                (system.atoms.C[ib])*
                                 (bigmess-cutoffterm)*distances[p]*rr;
-                            //}
-                            //if (system.molecules[i].atoms[j].C != 0) {
-                                system.molecules[k].atoms[l].efield[p] -= 
-                                (system.molecules[i].atoms[j].C )*
+                            if (!grid_b)
+                                field[3*ib+p] -= 
+                                (system.atoms.C[ia])*
                                 (bigmess-cutoffterm)*distances[p]*rr;
-                            //}
                          }
                       //      printf("efield[%i]: %f\n", p,system.molecules[i].atoms[j].efield[p]);
 
                     } // end p
 
                 } //cutoff 
-            } // end l
-            }  // end k
-        } // end j
-    } // end i
+            } // end partners ib
+    } // end ia
+    } // end parallel region
+
+    thole_field_collect(system, thread_field);
 
     /*
     printf("THOLE ELECTRIC FIELD: \n");
@@ -309,6 +360,10 @@ void thole_field(System &system) {
 
 } // end thole_field()
 
+void thole_field(System &system) {
+    BOX_DISPATCH(system, thole_field_box, system);
+}
+
 void thole_field_nopbc(System &system) {
     int p, i, j, k,l;
     double r;
@@ -319,7 +374,8 @@ void thole_field_nopbc(System &system) {
             for (k=i+1; k<system.molecules.size(); k++) {
                 for (l=0; l<system.molecules[k].atoms.size(); l++) {
                     if (system.molecules[i].frozen && system.molecules[k].frozen) continue;
-                    double* distances = getDistanceXYZ(system,i,j,k,l);
+                    double distances[4];
+                    getDistanceXYZ(system,i,j,k,l, distances);
                     r = distances[3];
                     //r = system.pairs[i][j][k][l].r;
                     //for (int n=0;n<3;n++) distances[n] = system.pairs[i][j][k][l].d[n];
@@ -336,6 +392,152 @@ void thole_field_nopbc(System &system) {
     }
 } // end thole_field_nopbc
 
+/* Fused pair sweep (fused_pairs on).
+With a stored A matrix, a full energy call on a polar model visits every atom pair up to
+four times -- lj(), coulombic_real(), thole_amatrix() and thole_field() -- each working out
+the minimum-image displacement again. fused_pairs_sweep() goes over the pairs once and does
+everything that applies to each: the A matrix block (all pairs), the Wolf field (other
+molecules, inside the cutoff) and, with rd_es, the LJ and Ewald real-space sums (same pairs
+and cutoffs as the separate kernels). lj() and coulombic_real() then take their sums from
+system.constants instead of walking the pairs, and polarization() goes straight to the
+dipole solve. After a single-molecule MC move only the A matrix and the field are needed.
+*/
+
+int fused_pairs_usable(System &system) {
+    int_fast8_t model = system.constants.potential_form;
+    if (!system.constants.fused_pairs || !system.constants.mc_pbc) return 0;
+    if (system.constants.polar_matrix_free || system.constants.fgrid_option || system.constants.feynman_hibbs) return 0;
+    if (system.constants.fgrid_efield && system.grids.efield[0].empty()) return 0; // field grid asked for but not made
+    return model == POTENTIAL_LJPOLAR || (model == POTENTIAL_LJESPOLAR && system.constants.ewald_es);
+}
+
+// A matrix and static field for polarization(); with rd_es also the lj and es real-space
+// pair sums, left in system.constants (fused_done) for lj() and coulombic_real()
+template <int BOX>
+void fused_pairs_sweep_box(System &system, int rd_es) {
+    const int N = system.atoms.x.size();
+    const double cutoff = system.pbc.cutoff;
+    const double l = system.constants.polar_damp;
+    const double alpha = system.constants.ewald_alpha;
+    const int_fast8_t do_es = rd_es && system.constants.potential_form == POTENTIAL_LJESPOLAR;
+    const int_fast8_t rd_lrc = system.constants.rd_lrc;
+    const double auto_reject_r = system.constants.auto_reject_r;
+    const int auto_reject_option = system.constants.auto_reject_option;
+    const double *C = &system.atoms.C[0];
+    const int *type = &system.atoms.type[0];
+    const int ntypes = system.atomtypes.n;
+    const double *mix_eps = &system.atomtypes.mix_eps[0], *mix_sig = &system.atomtypes.mix_sig[0];
+    const double *mix_sig6 = &system.atomtypes.mix_sig6[0], *mix_sig12 = &system.atomtypes.mix_sig12[0];
+    // wolf field terms, as in thole_field()
+    const double SMALL_dR = 1e-12;
+    const double wa = system.constants.polar_wolf_alpha;
+    const double rR = 1./cutoff;
+    const double cutoffterm = (erfc(wa*cutoff)*rR*rR + 2.0*wa*OneOverSqrtPi*exp(-wa*wa*cutoff*cutoff)*rR);
+
+    if (system.constants.ensemble == ENSEMBLE_UVT)
+        thole_resize_matrices(system);
+    amatrix_reserve(system, N);
+    const int cached = amatrix_frozen_cached(system); // if so, skip the pairs of frozen atoms
+    amatrix_diagonal(system, N);
+
+    const int nthreads = threadCount();
+    vector<double> thread_field(nthreads*3*N, 0.0), thread_lj(nthreads, 0.0), thread_es(nthreads, 0.0);
+    vector<int> thread_contact(nthreads, 0);
+
+    #pragma omp parallel
+    {
+    const int t = threadId();
+    double *field = &thread_field[t*3*N];
+    double sum_lj=0, sum_es=0, d[3], r, rr, ir6, sr6, sr12, bigmess=0, block[3][3];
+    vector<double> intra_es; // a molecule's own pairs come after the others in coulombic_real()
+    int b, p, contact=0;
+
+    #pragma omp for schedule(static, 16)
+    for (int a=0; a<N; a++) {
+        const int i = system.atoms.mol[a];
+        const int own_end = system.atoms.start[i+1]; // b < own_end: a's own molecule
+        const int row = type[a]*ntypes;
+        intra_es.clear();
+
+        // with the frozen blocks cached, a frozen molecule's own pairs have nothing left to do
+        for (b = (cached && system.atoms.frozen[a]) ? own_end : a+1; b<N; b++) {
+            const int_fast8_t both_frozen = system.atoms.frozen[a] && system.atoms.frozen[b];
+            r = sqrt(getDistance2<BOX>(system, a, b, d));
+
+            // 1) A matrix block
+            if (!(cached && both_frozen)) {
+                thole_block(d, r, l, block);
+                amatrix_set(system, a, b, block);
+                amatrix_set(system, b, a, block);
+            }
+
+            if (b < own_end) { // intramolecular ewald correction
+                if (do_es && !both_frozen && C[a] != 0 && C[b] != 0)
+                    intra_es.push_back(-(C[a] * C[b] * erf(alpha*r) / r));
+                continue;
+            }
+
+            // 2) LJ
+            if (rd_es) {
+                const int k = row + type[b];
+                const double eps = mix_eps[k];
+                if (eps != 0 && mix_sig[k] != 0) {
+                    if (auto_reject_option && r <= auto_reject_r) contact = 1;
+                    if (!rd_lrc || r <= cutoff) {
+                        ir6 = 1.0/(r*r);
+                        ir6 *= ir6*ir6;
+                        sr6 = mix_sig6[k]*ir6;
+                        sr12 = mix_sig12[k]*ir6*ir6;
+                        sum_lj += 4.0*eps*(sr12 - sr6);
+                    }
+                }
+            }
+            if (both_frozen) continue;
+
+            // 3) ewald real space
+            if (do_es && C[a] != 0 && C[b] != 0 && r < cutoff && std::isnan(sum_es) == 0)
+                sum_es += C[a] * C[b] * erfc(alpha*r) / r;
+
+            // 4) wolf field
+            if ((r - SMALL_dR < cutoff) && (r != 0.)) {
+                rr = 1./r;
+                if (wa != 0)
+                    bigmess = (erfc(wa*r)*rr*rr+2.0*wa*OneOverSqrtPi*exp(-wa*wa*r*r)*rr);
+                for (p=0; p<3; p++) {
+                    if (wa == 0) {
+                        field[3*a+p] += C[b]*(rr*rr-rR*rR)*d[p]*rr;
+                        field[3*b+p] -= C[a]*(rr*rr-rR*rR)*d[p]*rr;
+                    } else {
+                        field[3*a+p] += C[b]*(bigmess-cutoffterm)*d[p]*rr;
+                        field[3*b+p] -= C[a]*(bigmess-cutoffterm)*d[p]*rr;
+                    }
+                }
+            }
+        } // end b
+        for (p=0; p<intra_es.size(); p++)
+            if (std::isnan(sum_es) == 0) sum_es += intra_es[p];
+    } // end a
+
+    thread_lj[t] = sum_lj;
+    thread_es[t] = sum_es;
+    thread_contact[t] = contact;
+    } // end parallel region
+
+    thole_field_collect(system, thread_field);
+    if (rd_es) {
+        system.constants.fused_done = 1;
+        system.constants.fused_lj = sumThreads(thread_lj);
+        system.constants.fused_es_real = sumThreads(thread_es);
+        system.constants.fused_contact = 0;
+        for (int t=0; t<nthreads; t++)
+            if (thread_contact[t]) system.constants.fused_contact = 1;
+    }
+}
+
+void fused_pairs_sweep(System &system, int rd_es) {
+    BOX_DISPATCH(system, fused_pairs_sweep_box, system, rd_es);
+}
+
 // =========================== POLAR POTENTIAL ========================
 double polarization(System &system) {
 
@@ -366,6 +568,23 @@ double polarization(System &system) {
     }
 */
 
+    // keep what this overwrites, in case the MC move is rejected (revertToCheckpoint())
+    polarSaveAll(system);
+
+    if (system.constants.fused_done) {
+        // 0-1) A MATRIX AND FIELD ALREADY MADE BY THE FUSED SWEEP IN getTotalPotential()
+        system.checkpoint("A matrix and field from the fused pair sweep.");
+    } else if (fused_pairs_usable(system)) {
+        // 0-1) A MATRIX AND FIELD IN ONE PASS OVER THE PAIRS
+        fused_pairs_sweep(system, 0);
+        system.checkpoint("done with fused_pairs_sweep(). Doing dipole iterations");
+    } else {
+    if (system.constants.polar_matrix_free) {
+        // 0) NO A MATRIX: JUST LIST THE DIPOLE PAIRS; THEIR TENSOR BLOCKS ARE MADE IN THE CONTRACTION
+        makeAtomMap(system);
+        thole_pairlist(system);
+        system.checkpoint("done with thole_pairlist(). Running thole_field()");
+    } else {
     // 00) RESIZE THOLE A MATRIX IF NEEDED
     if (system.constants.ensemble == ENSEMBLE_UVT) {
         thole_resize_matrices(system);
@@ -376,6 +595,7 @@ double polarization(System &system) {
     // 0) MAKE THOLE A MATRIX
     thole_amatrix(system); // ***this function also makes the i,j -> single-index atommap.
     system.checkpoint("done running thole_amatrix(). Running thole_field()");
+    }
 
     // 1) CALCULATE ELECTRIC FIELD AT EACH SITE
     if (system.constants.mc_pbc)
@@ -383,10 +603,14 @@ double polarization(System &system) {
     else
         thole_field_nopbc(system); // maybe in wrong place? doubt it. 4-13-17
     system.checkpoint("done with thole_field(). Doing dipole iterations");
+    }
 
 
     // 2) DO DIPOLE ITERATIONS
-    num_iterations = thole_iterative(system);    
+    if (system.constants.polar_pcg)
+        num_iterations = thole_pcg(system);
+    else
+        num_iterations = thole_iterative(system);
 //    printf("num_iterations = %f\n", (double)num_iterations);
     system.stats.polar_iterations = (double)num_iterations;
     system.constants.dipole_rrms = get_dipole_rrms(system);
@@ -416,6 +640,186 @@ double polarization(System &system) {
 
 
 
+// static (wolf) field at flat atom ia from the charges of all other molecules: one row of thole_field()
+void thole_field_row(System &system, int ia, vector<int> &partners, double *field) {
+    int n, p, ib;
+    const double SMALL_dR = 1e-12;
+    double r, rr, distances[3];
+    const double R = system.pbc.cutoff;
+    const double rR = 1./R;
+    const double a = system.constants.polar_wolf_alpha;
+    const double erR=erfc(a*R);
+    const double cutoffterm = (erR*rR*rR + 2.0*a*OneOverSqrtPi*exp(-a*a*R*R)*rR);
+    double bigmess=0;
+
+    for (p=0; p<3; p++) field[p] = 0;
+    // a sorbate site gets the framework part from the field grid (fgrid_efield)
+    const int_fast8_t grid = system.constants.fgrid_efield && !system.atoms.frozen[ia];
+    if (grid) {
+        double pos[3] = {system.atoms.x[ia], system.atoms.y[ia], system.atoms.z[ia]};
+        fgrid_efield_at(system, pos, field);
+    }
+    cellPartners(system, ia, 0, 1, partners);
+    for (n=0; n<partners.size(); n++) {
+        ib = partners[n];
+        if ( system.atoms.frozen[ia] && system.atoms.frozen[ib] ) continue; //don't let the MOF polarize itself
+        if ( grid && system.atoms.frozen[ib] ) continue;
+
+        r = getDistanceAtoms(system, ia, ib, distances);
+        if((r - SMALL_dR  < system.pbc.cutoff) && (r != 0.)) {
+            rr = 1./r;
+            if ( a != 0 )
+                bigmess=(erfc(a*r)*rr*rr+2.0*a*OneOverSqrtPi*exp(-a*a*r*r)*rr);
+            for ( p=0; p<3; p++ ) {
+                if ( a == 0 )
+                    field[p] += (system.atoms.C[ib])*(rr*rr-rR*rR)*distances[p]*rr;
+                else
+                    field[p] += (system.atoms.C[ib])*(bigmess-cutoffterm)*distances[p]*rr;
+            }
+        }
+    }
+}
+
+/* Local polarization update (polar_local_radius > 0, with delta energies).
+After a single-molecule move only the polarizable sites within polar_local_radius of the
+molecule -- where it was and where it went -- get a new static field and re-iterated
+dipoles, contracted on the fly over their in-cutoff partners (thole_contract_pairs). All
+other sites keep the field and dipole of the last accepted state. The region comes from
+the cell list (radius <= cutoff), only its sites are saved for a reject, and the energy is
+the last accepted one corrected over the region, so the cost follows the size of that
+region instead of N. getMovePotential() does the full solve instead on every
+polar_local_refresh-th step, which bounds the error. */
+
+// mu*E of one site, the term it adds to -2x the polarization energy
+inline double polar_site_energy(System &system, Atom &atom) {
+    double u = dddotprod(atom.dip, atom.efield);
+    if (system.constants.polar_palmo)
+        u += dddotprod(atom.dip, atom.efield_induced_change);
+    return u;
+}
+
+double polarization_local(System &system) {
+    int a, m, n, p, iteration_counter;
+    double dist[4], error;
+    const int N = system.atoms.x.size();
+    const double radius = system.constants.polar_local_radius;
+    const vector<double> &centers = system.constants.polar_local_centers;
+    const double allowed_sqerr = system.constants.polar_precision*system.constants.polar_precision*
+                    system.constants.DEBYE2SKA*system.constants.DEBYE2SKA;
+    vector<int> &region = system.constants.polar_local_region;
+    vector<int> &near = system.constants.polar_local_near;
+    vector<int> &start = system.constants.polar_local_start;
+    vector<int> &pairs = system.constants.polar_local_pairs;
+    vector<int_fast8_t> &mark = system.constants.polar_local_mark;
+    if (mark.size() < N) mark.resize(N, 0);
+
+    // 1) THE SITES NEAR THE MOLECULE: from the cells around each center, or every atom
+    // if the cells are off or narrower than the radius
+    const int_fast8_t use_cells = system.cells.active && radius <= system.pbc.cutoff;
+    region.clear();
+    for (n=0; n+2<centers.size(); n+=3) {
+        near.clear();
+        if (use_cells)
+            cellsNear(system, (double *)&centers[n], near);
+        for (m=0; m<(use_cells ? (int)near.size() : N); m++) {
+            a = use_cells ? near[m] : m;
+            if (mark[a] || system.atoms.polar[a] == 0) continue;
+            double pos[3] = {system.atoms.x[a], system.atoms.y[a], system.atoms.z[a]};
+            getR(system, pos, (double *)&centers[n], dist);
+            if (dist[3] < radius) {
+                mark[a] = 1;
+                region.push_back(a);
+            }
+        }
+    }
+    for (m=0; m<region.size(); m++) mark[region[m]] = 0;
+
+    // their partners, and what they add to the energy now (a new site has no dipole yet)
+    double sum = -2.0*system.stats.polar.value - system.constants.polar_local_gone;
+    start.resize(region.size()+1);
+    pairs.clear();
+    for (m=0; m<region.size(); m++) {
+        start[m] = pairs.size();
+        thole_pairlist_row(system, region[m], system.constants.polar_local_partners, pairs);
+        polarSave(system, region[m]);
+        sum -= polar_site_energy(system, system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]]);
+    }
+    start[region.size()] = pairs.size();
+
+    // 2) THEIR STATIC FIELDS. new (inserted) sites start from alpha*E
+    for (m=0; m<region.size(); m++) {
+        Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+        thole_field_row(system, region[m], system.constants.polar_local_partners, atom.efield);
+        if (atom.dip[0] == 0 && atom.dip[1] == 0 && atom.dip[2] == 0)
+            for (p=0; p<3; p++)
+                atom.dip[p] = system.constants.polar_gamma * atom.polar * (atom.efield[p] + atom.efield_self[p]);
+    }
+
+    // 3) ITERATE THEIR DIPOLES AGAINST THE FIXED ONES OUTSIDE
+    for (iteration_counter=1; ; iteration_counter++) {
+        if (iteration_counter >= MAX_ITERATION_COUNT && system.constants.polar_precision) {
+            for (m=0; m<region.size(); m++) {
+                Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+                for (p=0; p<3; p++) {
+                    atom.dip[p] = atom.polar * (atom.efield[p] + atom.efield_self[p]);
+                    atom.efield_induced_change[p] = 0.0;
+                }
+            }
+            system.constants.iter_success = 1;
+            printf("POLAR CONVERGENCE FAILURE\n");
+            break;
+        }
+
+        for (m=0; m<region.size(); m++) {
+            Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+            for (p=0; p<3; p++) {
+                atom.olddip[p] = atom.dip[p];
+                atom.efield_induced[p] = 0;
+            }
+            thole_contract_pairs(system, region[m], pairs.data() + start[m], start[m+1] - start[m], NULL, atom.efield_induced);
+            for (p=0; p<3; p++) {
+                atom.newdip[p] = atom.polar * (atom.efield[p] + atom.efield_self[p] + atom.efield_induced[p]);
+                if (system.constants.polar_gs || system.constants.polar_gs_ranked)
+                    atom.dip[p] = atom.newdip[p];
+            }
+        }
+
+        // done? (same rule as are_we_done_yet(), over the region)
+        int done = 1;
+        if (system.constants.polar_precision == 0.0)
+            done = (iteration_counter >= system.constants.polar_max_iter);
+        else
+            for (m=0; m<region.size() && done; m++) {
+                Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+                for (p=0; p<3; p++) {
+                    error = atom.newdip[p] - atom.olddip[p];
+                    if (error*error > allowed_sqerr) done = 0;
+                }
+            }
+
+        // change in induced field for palmo, from the last contraction
+        if (system.constants.polar_palmo && done)
+            for (m=0; m<region.size(); m++) {
+                Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+                for (p=0; p<3; p++) atom.efield_induced_change[p] = -atom.efield_induced[p];
+                thole_contract_pairs(system, region[m], pairs.data() + start[m], start[m+1] - start[m], NULL, atom.efield_induced_change);
+            }
+
+        for (m=0; m<region.size(); m++) {
+            Atom &atom = system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]];
+            for (p=0; p<3; p++) atom.dip[p] = atom.newdip[p];
+        }
+        if (done) break;
+    }
+    system.stats.polar_iterations = (double)iteration_counter;
+
+    // 4) ENERGY, 1/2 mu*E: the last accepted sum with the region's terms swapped for the new ones
+    for (m=0; m<region.size(); m++)
+        sum += polar_site_energy(system, system.molecules[system.atommap[region[m]][0]].atoms[system.atommap[region[m]][1]]);
+    return -0.5*sum;
+}
+
+
 void polarization_force(System &system) {
     // gets force on atoms due to dipoles calculated before (via iterative method)
     // TODO
@@ -7,16 +7,20 @@
 #include <stdlib.h>
 
 #include "distance.cpp"
+#include "cells.cpp"
+#include "atom_arrays.cpp"
+#include "simd.cpp"
 #include "lj.cpp"
 #include "commy.cpp"
 #include "coulombic.cpp"
+#include "framework_grid.cpp"
 #include "polar.cpp"
 #include "pairs.cpp"
 
 // =================== MAIN FUNCTION ======================
 // ---------------POTENTIAL OF ENTIRE SYSTEM --------------
-double getTotalPotential(System &system) {
-    int_fast8_t model = system.constants.potential_form;
+template <int TERMS>
+double getTotalPotentialT(System &system) {
     // compute all interaction distances
     //make_pairs(system);
 
@@ -24,25 +28,42 @@ double getTotalPotential(System &system) {
     double total_potential=0;
     double total_rd=0.0; double total_es = 0.0; double total_polar=0.0;
     system.constants.auto_reject=0;
+    // MC moves keep the flat copy of the atoms current (atom_arrays.cpp); MD moves them without it
+    if (system.constants.mode != "mc" || system.atoms.start.size() != system.molecules.size()+1)
+        buildAtomArrays(system);
+    if ((TERMS & TERM_POLAR) && system.molecules.size() > 0 && fused_pairs_usable(system)) {
+        polarSaveAll(system); // the sweep overwrites the fields polarization() would have saved
+        fused_pairs_sweep(system, 1); // lj, es real space and the polar A matrix and field in one pass over the pairs
+    }
 
 // =========================================================================
 if (system.molecules.size() > 0) { // don't bother with 0 molecules!
     // REPULSION DISPERSION.
-    if (model == POTENTIAL_LJ || model == POTENTIAL_LJES || model == POTENTIAL_LJPOLAR || model == POTENTIAL_LJESPOLAR) {
+    if (TERMS & TERM_LJ) {
         total_rd = lj(system);
-    } else if (model == POTENTIAL_COMMY || model == POTENTIAL_COMMYES || model == POTENTIAL_COMMYESPOLAR) {
+        if (system.constants.fgrid_option && !(system.constants.auto_reject_option && system.constants.auto_reject)) {
+            double framework_rd = fgrid_rd(system);
+            total_rd += framework_rd;
+            system.stats.lj.value += framework_rd;
+        }
+    } else if (TERMS & TERM_COMMY) {
         total_rd = commy(system);
     }
     if (system.constants.mode=="md" || (!system.constants.auto_reject_option || !system.constants.auto_reject)) { // these only run if no bad contact was discovered in MC
     // ELECTROSTATIC
-    if (model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR || model == POTENTIAL_COMMYES || model == POTENTIAL_COMMYESPOLAR) {
+    if (TERMS & TERM_ES) {
         if (system.constants.ewald_es)
             total_es = coulombic_ewald(system); // using ewald method for es
         else
             total_es = coulombic(system); // plain old coloumb
+        if (system.constants.fgrid_option) {
+            double framework_es = fgrid_es(system);
+            total_es += framework_es;
+            system.stats.es_real.value += framework_es;
+        }
     }
     // POLARIZATION
-    if (model == POTENTIAL_LJESPOLAR || model == POTENTIAL_LJPOLAR || model == POTENTIAL_COMMYESPOLAR) {
+    if (TERMS & TERM_POLAR) {
         total_polar = polarization(system); // yikes
     }
     }
@@ -56,7 +77,189 @@ if (system.molecules.size() > 0) { // don't bother with 0 molecules!
     system.stats.es.value = total_es;
     system.stats.polar.value = total_polar;
     system.stats.potential.value = total_potential;
+    system.constants.fused_done = 0;
 
 //    printf("MC STEP %i ::: rd %f es %f pol %f tot %f\n", system.stats.MCstep, total_rd, total_es, total_polar, total_potential);
 	return total_potential;
 }
+
+
+// ------------- PAIRWISE POTENTIAL OF ONE MOLECULE -----------------
+// the parts of the total potential that change when only molecule molid moves:
+// energies[0] = rd pairs (lj+fh or commy), [1] = unused, [2] = es real (or plain coulomb)
+// call with after_move=0 on the old configuration and after_move=1 on the new one; the
+// molecule's ewald structure factor terms are taken out / put back in accordingly.
+template <int TERMS>
+void getMoleculePotentialT(System &system, int molid, double *energies, int after_move) {
+    const int check_contacts = after_move; // old configuration was already accepted
+    energies[0] = 0; energies[1] = 0; energies[2] = 0;
+    if (check_contacts) system.constants.auto_reject=0;
+
+    if (system.constants.polar_local_radius > 0) { // where the molecule was/is, for polarization_local()
+        // and its share of the accepted polarization sum, in case it leaves (remove); a molecule
+        // that is still there after the move is in the region and accounted for there
+        system.constants.polar_local_gone = 0;
+        for (int a=system.atoms.start[molid]; a<system.atoms.start[molid+1]; a++) {
+            system.constants.polar_local_centers.push_back(system.atoms.x[a]);
+            system.constants.polar_local_centers.push_back(system.atoms.y[a]);
+            system.constants.polar_local_centers.push_back(system.atoms.z[a]);
+            if (!after_move)
+                system.constants.polar_local_gone += polar_site_energy(system, system.molecules[molid].atoms[a-system.atoms.start[molid]]);
+        }
+    }
+
+    if (TERMS & TERM_LJ) {
+        energies[0] = lj_molecule(system, molid, check_contacts);
+        if (system.constants.fgrid_option && !(check_contacts && system.constants.auto_reject_option && system.constants.auto_reject))
+            energies[0] += fgrid_rd_molecule(system, molid);
+    } else if (TERMS & TERM_COMMY) {
+        energies[0] = commy_molecule(system, molid);
+    }
+    if (check_contacts && system.constants.auto_reject_option && system.constants.auto_reject) return; // bad contact, move is rejected anyway
+
+    if (TERMS & TERM_ES) {
+        if (system.constants.ewald_es) {
+            energies[2] = coulombic_real_molecule(system, molid);
+            coulombic_reciprocal_molecule(system, molid, after_move ? 1.0 : -1.0);
+        } else
+            energies[2] = coulombic_molecule(system, molid);
+        if (system.constants.fgrid_option)
+            energies[2] += fgrid_es_molecule(system, molid);
+    }
+}
+
+// ---------- TOTAL POTENTIAL AFTER A SINGLE-MOLECULE MC MOVE -----------
+// pair terms are updated by the difference old -> new (from getMoleculePotential).
+// ewald recip comes from the updated structure factors;
+// ewald self and the lj lrc terms come from the atom type counts; polarization is recomputed as usual.
+template <int TERMS>
+double getMovePotentialT(System &system, double *old_energies, double *new_energies) {
+    double total_rd, total_es=0.0, total_polar=0.0;
+
+    if (system.constants.auto_reject_option && system.constants.auto_reject) { // a really big energy
+        system.constants.polar_local_centers.clear();
+        return 1e40;
+    }
+
+    // REPULSION DISPERSION
+    total_rd = system.stats.rd.value + new_energies[0] - old_energies[0];
+    if (TERMS & TERM_LJ) {
+        system.stats.lj.value += new_energies[0] - old_energies[0]; // carries the FH correction too, when on
+        if (system.constants.rd_lrc) {
+            double lrc = lj_lrc(system), self_lrc = self_lj_lrc(system);
+            total_rd += lrc - system.stats.lj_lrc.value + self_lrc - system.stats.lj_self_lrc.value;
+            system.stats.lj_lrc.value = lrc;
+            system.stats.lj_self_lrc.value = self_lrc;
+        }
+    }
+    // ELECTROSTATIC
+    if (TERMS & TERM_ES) {
+        if (system.constants.ewald_es) {
+            system.stats.es_self.value = coulombic_self(system);
+            system.stats.es_real.value += new_energies[2] - old_energies[2];
+            system.stats.es_recip.value = coulombic_reciprocal_sf(system);
+            total_es = system.stats.es_self.value + system.stats.es_real.value + system.stats.es_recip.value;
+        } else
+            total_es = system.stats.es.value + new_energies[2] - old_energies[2];
+    }
+    // POLARIZATION (only near the molecule in local mode, with a full solve every polar_local_refresh steps)
+    if (TERMS & TERM_POLAR) {
+        if (system.constants.polar_local_radius > 0 && system.constants.mc_pbc && system.stats.MCstep % system.constants.polar_local_refresh != 0)
+            total_polar = polarization_local(system);
+        else
+            total_polar = polarization(system);
+    }
+    system.constants.polar_local_centers.clear();
+
+    system.stats.rd.value = total_rd;
+    system.stats.es.value = total_es;
+    system.stats.polar.value = total_polar;
+    system.stats.potential.value = total_rd + total_es + total_polar;
+
+    return system.stats.potential.value;
+}
+
+// atomic forces (calculateForces(), md.cpp); flat atom arrays are made there
+template <int TERMS, int PBC>
+void atomicForcesT(System &system) {
+    if (!PBC) {
+        if (TERMS & TERM_LJ)
+            lj_force_nopbc(system);
+        if ((TERMS & TERM_LJ) && (TERMS & TERM_ES))
+            coulombic_force_nopbc(system);
+    } else {
+        if (TERMS & TERM_LJ)
+            lj_force(system);
+        if ((TERMS & TERM_LJ) && (TERMS & TERM_ES))
+            coulombic_real_force(system);
+        if ((TERMS & TERM_LJ) && (TERMS & TERM_POLAR))
+            polarization_force(system);
+    }
+}
+
+double getTotalPotential(System &system) {
+    return system.kernels.total(system);
+}
+
+void getMoleculePotential(System &system, int molid, double *energies, int after_move) {
+    system.kernels.molecule(system, molid, energies, after_move);
+}
+
+double getMovePotential(System &system, double *old_energies, double *new_energies) {
+    return system.kernels.move(system, old_energies, new_energies);
+}
+
+// ------------- POTENTIAL FORM, PICKED ONCE ------------------
+template <int TERMS>
+void setupTerms(System &system) {
+    system.kernels.total = getTotalPotentialT<TERMS>;
+    system.kernels.molecule = getMoleculePotentialT<TERMS>;
+    system.kernels.move = getMovePotentialT<TERMS>;
+    system.kernels.forces = system.constants.md_pbc ? atomicForcesT<TERMS, 1> : atomicForcesT<TERMS, 0>;
+}
+
+#define LJ_KERNELS(F) case F: \
+    system.kernels.lj = lj_box<BOX, F>; \
+    system.kernels.lj_molecule = lj_molecule_box<BOX, F>; \
+    break;
+template <int BOX>
+void setupLjKernels(System &system, int flags) {
+    switch (flags) {
+        LJ_KERNELS(0) LJ_KERNELS(1) LJ_KERNELS(2) LJ_KERNELS(3)
+        LJ_KERNELS(4) LJ_KERNELS(5) LJ_KERNELS(6) LJ_KERNELS(7)
+    }
+}
+#undef LJ_KERNELS
+
+// after readInput() and setupBox(): the options below don't change during a run
+void setupPotentialForm(System &system) {
+    switch (system.constants.potential_form) {
+        case POTENTIAL_LJ: setupTerms<TERM_LJ>(system); break;
+        case POTENTIAL_LJES: setupTerms<TERM_LJ | TERM_ES>(system); break;
+        case POTENTIAL_LJPOLAR: setupTerms<TERM_LJ | TERM_POLAR>(system); break;
+        case POTENTIAL_LJESPOLAR: setupTerms<TERM_LJ | TERM_ES | TERM_POLAR>(system); break;
+        case POTENTIAL_COMMY: setupTerms<TERM_COMMY>(system); break;
+        case POTENTIAL_COMMYES: setupTerms<TERM_COMMY | TERM_ES>(system); break;
+        case POTENTIAL_COMMYESPOLAR: setupTerms<TERM_COMMY | TERM_ES | TERM_POLAR>(system); break;
+        default:
+            printf("ERROR: unknown potential form %i.\n", (int)system.constants.potential_form);
+            exit(1);
+    }
+
+    const int flags = (system.constants.feynman_hibbs ? LJ_FH : 0) | (system.constants.rd_lrc ? LJ_LRC : 0)
+        | (system.constants.auto_reject_option ? LJ_REJECT : 0);
+    switch (system.pbc.box_policy) {
+        case BOX_ORTHO: setupLjKernels<BOX_ORTHO>(system, flags); break;
+        case BOX_TRICLINIC: setupLjKernels<BOX_TRICLINIC>(system, flags); break;
+        default: setupLjKernels<BOX_NONE>(system, flags); break;
+    }
+}
+
+// compare the delta-tracked potential with a full recompute, and resync to the latter.
+void checkEnergyDrift(System &system) {
+    double tracked = system.stats.potential.value;
+    double full = getTotalPotential(system);
+    system.constants.iter_success = 0; // nothing to accept/reject here
+    system.stats.energy_drift = tracked - full;
+}
+
@@ -35,43 +35,51 @@ void setupRadialDist(System &system) {
 }
 
 
+// bin every ordered centroid/counterpart pair (a,b) of flat atoms, intramolecular too b/c MD
+// needs it sometimes. with use_cells the partners of a come from its 27 cells (cellPartners())
+template <int BOX>
+void radial_pairs_box(System &system, int centroid, int counterpart, int_fast8_t use_cells) {
+    const double bin_size = system.stats.radial_bin_size;
+    const double max_dist = system.stats.radial_max_dist;
+    const vector<int> &name_id = system.atomtypes.name_id;
+    const int natoms = system.atoms.x.size();
+    vector<int> &partners = system.atoms.partners;
+    double d[3];
+
+    for (int a=0; a<natoms; a++) {
+        const int na = name_id[system.atoms.type[a]];
+        if (na != centroid && na != counterpart) continue;
+        const int want = (na == centroid) ? counterpart : centroid; // either way round
+        const int i = system.atoms.mol[a];
+        cellPartners(system, a, 0, use_cells, partners);
+        for (int b=system.atoms.start[i]; b<system.atoms.start[i+1]; b++)
+            if (b != a) partners.push_back(b); // own molecule; no self interaction (r=0)
+        for (int n=0; n<partners.size(); n++) {
+            const int b = partners[n];
+            const int nb = name_id[system.atoms.type[b]];
+            if (nb != want) continue;
+            double r = sqrt(getDistance2<BOX>(system, a, b, d));
+            if (r < max_dist) {
+                // determine index of radial_bins
+                int indexr = floor(r / bin_size);  // so 0.02/0.2 -> index 0; 0.25/0.2 -> index 1..
+                system.stats.radial_bins[indexr]++;
+            } // end dist<max_dist
+        } // end partners b
+    } // end a
+}
+
 /* THIS FUNCTION WILL BE CALLED EVERY CORRTIME AND WILL ADD TO BINS AS NEEDED */ 
 /* every step is a little excessive and increases step runtime by ~x15        */
 void radialDist(System &system) {
-    const double bin_size = system.stats.radial_bin_size;
-    const double max_dist = system.stats.radial_max_dist;
-    string centroid = system.stats.radial_centroid;
-    string counterpart = system.stats.radial_counterpart;
+    const int centroid = atomNameId(system, system.stats.radial_centroid); // -1 matches nothing
+    const int counterpart = atomNameId(system, system.stats.radial_counterpart);
+    if (centroid < 0 || counterpart < 0) return;
 
-    //system.checkpoint("starting loop");
-    // loop through all the atom pairs. Doing intramolecular too b/c MD needs it sometimes.
-    for (int i=0; i<system.molecules.size(); i++) {
-        for (int j=0; j<system.molecules[i].atoms.size(); j++) {
-            for (int k=0; k<system.molecules.size(); k++) { // k=i+1 would skip intramolec
-                for (int l=0; l<system.molecules[k].atoms.size(); l++) {
-                    // and only if its a centroid/counterpart pair
-                    if (
-                        !(i==k && j==l) // don't do self interaction (r=0)
-                     && ((system.molecules[i].atoms[j].name == centroid && system.molecules[k].atoms[l].name == counterpart)
-                     || (system.molecules[i].atoms[j].name == counterpart && system.molecules[k].atoms[l].name == centroid))) 
-                    {
-                        double* distances = getDistanceXYZ(system, i, j, k, l);
-                        double r = distances[3];     
-                        //printf("distance = %f\n",dist);      
-                        //system.checkpoint("getting index"); 
-                        if (r < max_dist) {
-                            // determine index of radial_bins
-                            int indexr = floor(r / bin_size);  // so 0.02/0.2 -> index 0; 0.25/0.2 -> index 1..
-                            //system.checkpoint("adding to bin");
-                            system.stats.radial_bins[indexr]++;
-                        } // end dist<max_dist
-
-                    } // end if proper pair.
-                } // end atoms-in-k loop l
-            } // end molecules loop k
-        } // end atoms-in-i loop j
-    } // end molecules loop i
-    //system.checkpoint("ending radialDist");
+    // MC moves keep the atom arrays and cells current; MD only rebuilds them for the forces
+    if (system.constants.mode == "md") buildAtomArrays(system);
+    // the 27 cells only reach a bit past the cutoff, so farther bins need all pairs
+    const int_fast8_t use_cells = system.stats.radial_max_dist <= system.pbc.cutoff;
+    BOX_DISPATCH(system, radial_pairs_box, system, centroid, counterpart, use_cells);
     return;
 }
 
@@ -116,10 +124,11 @@ void writeRadialDist(System &system) {
 void countAtomInRadius(System &system, string atomname, double radius) {
     int count=0;
     double r=0;
+    const int name = atomNameId(system, atomname); // -1 matches nothing
     // loop through all atoms and count the number that are within radius
     for (int i=0; i<system.molecules.size(); i++) {
         for (int j=0; j<system.molecules[i].atoms.size(); j++) {
-            if (system.molecules[i].atoms[j].name == atomname) {
+            if (system.atomtypes.name_id[system.molecules[i].atoms[j].type] == name) {
                 for (int n=0; n<3; n++) 
                     r += system.molecules[i].atoms[j].pos[n] * system.molecules[i].atoms[j].pos[n];
 
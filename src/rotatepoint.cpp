@@ -7,7 +7,7 @@
 #include <string>
 #include <stdlib.h>
 
-double * rotatePoint(System &system, double x, double y, double z, int plane, double angle) {
+void rotatePoint(System &system, double x, double y, double z, int plane, double angle, double *output) {
 
 	double finalx, finaly, finalz;// printf("%f %f %f\n",x,y,z);
     // the function takes an ANGLE 0->360 so need to preconvert from rads if neededo
@@ -26,14 +26,12 @@ double * rotatePoint(System &system, double x, double y, double z, int plane, do
 		finalz = z;
 	}
 
-	static double output[3]; //double* output[3]; //vector<double> output; //printf("%f %f %f\n",finalx,finaly,finalz);
         output[0] = finalx;
         output[1] = finaly;
 	    output[2] = finalz;
-        return output;
 }
 
-double * rotatePointRadians(System &system, double x, double y, double z, int plane, double angle) {
+void rotatePointRadians(System &system, double x, double y, double z, int plane, double angle, double *output) {
 
 	double finalx, finaly, finalz;// printf("%f %f %f\n",x,y,z);
     // the function takes an ANGLE 0->360 so need to preconvert from rads if neededo
@@ -52,11 +50,9 @@ double * rotatePointRadians(System &system, double x, double y, double z, int pl
 		finalz = z;
 	}
 
-	static double output[3]; //double* output[3]; //vector<double> output; //printf("%f %f %f\n",finalx,finaly,finalz);
         output[0] = finalx;
         output[1] = finaly;
 	    output[2] = finalz;
-        return output;
 }
 // -------------- end rotatePoint func ---------------------
 
@@ -67,7 +63,8 @@ void rotateMolecule(System &system, Molecule mol, string plane, double angle) {
     // for each atom in molecule, rotate it.
     for (int i=0; i<mol.atoms.size(); i++) {
         
-        double* rotated = rotatePoint(system, mol.atoms[i].pos[0], mol.atoms[i].pos[1], mol.atoms[i].pos[2], plane, angle);
+        double rotated[3];
+        rotatePoint(system, mol.atoms[i].pos[0], mol.atoms[i].pos[1], mol.atoms[i].pos[2], plane, angle, rotated);
 
         for (int n=0; n<3; n++) mol.atoms[i].pos[n] = rotated[n];
          
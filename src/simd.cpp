@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#if defined(__AVX512F__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+using namespace std;
+
+/* Vectorized pair kernels for LJ and the Ewald real-space sum.
+Each call takes one atom a of system.atoms against a list (or range) of partner atoms
+and does SIMD_WIDTH pairs at a time; the last, partial vector is masked.
+amatrix_row_simd() at the bottom is the dipole contraction's block-row GEMV.
+The vector type below is AVX-512 or AVX2 when the compiler targets them
+(e.g. -march=native, see compile.sh). Otherwise it's a plain double, and the same
+kernels are ordinary scalar loops.
+FH corrections and intramolecular terms stay in the scalar code of lj.cpp / coulombic.cpp.
+*/
+
+#if defined(__AVX512F__)
+#define SIMD_WIDTH 8
+#define SIMD_NAME "AVX-512"
+typedef __m512d vd; // SIMD_WIDTH doubles
+typedef __mmask8 vm; // lane mask
+typedef __m256i vi; // SIMD_WIDTH int indices
+static inline vd vset1(double x) { return _mm512_set1_pd(x); }
+static inline vd vadd(vd a, vd b) { return _mm512_add_pd(a, b); }
+static inline vd vsub(vd a, vd b) { return _mm512_sub_pd(a, b); }
+static inline vd vmul(vd a, vd b) { return _mm512_mul_pd(a, b); }
+static inline vd vdiv(vd a, vd b) { return _mm512_div_pd(a, b); }
+static inline vd vfmadd(vd a, vd b, vd c) { return _mm512_fmadd_pd(a, b, c); } // a*b+c
+static inline vd vsqrt(vd a) { return _mm512_sqrt_pd(a); }
+static inline vd vmin(vd a, vd b) { return _mm512_min_pd(a, b); }
+static inline vd vrint(vd a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline vd vfloor(vd a) { return _mm512_roundscale_pd(a, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC); }
+static inline vm vlt(vd a, vd b) { return _mm512_cmp_pd_mask(a, b, _CMP_LT_OQ); }
+static inline vm vle(vd a, vd b) { return _mm512_cmp_pd_mask(a, b, _CMP_LE_OQ); }
+static inline vm vneq(vd a, vd b) { return _mm512_cmp_pd_mask(a, b, _CMP_NEQ_OQ); }
+static inline vm vand(vm a, vm b) { return a & b; }
+static inline vm vfirst(int n) { return (vm)((1u << n) - 1); } // lanes 0..n-1
+static inline vd vselect(vm m, vd a, vd b) { return _mm512_mask_blend_pd(m, b, a); } // m ? a : b
+static inline vd vkeep(vm m, vd a) { return _mm512_maskz_mov_pd(m, a); } // m ? a : 0
+static inline vi vloadi(const int *p) { return _mm256_loadu_si256((const __m256i *)p); }
+static inline vi vtoint(vd a) { return _mm512_cvttpd_epi32(a); }
+static inline vd vgather(const double *base, vi idx) { return _mm512_i32gather_pd(idx, base, 8); }
+static inline vd vloadn(const double *p, int n) { return _mm512_maskz_loadu_pd(vfirst(n), p); }
+static inline vd vload(const double *p) { return _mm512_loadu_pd(p); }
+static inline vd vload(const float *p) { return _mm512_cvtps_pd(_mm256_loadu_ps(p)); } // widened to double
+static inline void vstoren(double *p, vd a, int n) { _mm512_mask_storeu_pd(p, vfirst(n), a); }
+static inline double vsum(vd a) { return _mm512_reduce_add_pd(a); }
+static inline double vminval(vd a) { return _mm512_reduce_min_pd(a); }
+
+#elif defined(__AVX2__)
+#define SIMD_WIDTH 4
+#define SIMD_NAME "AVX2"
+typedef __m256d vd;
+typedef __m256d vm; // all-ones / all-zeros lanes
+typedef __m128i vi;
+static inline vd vset1(double x) { return _mm256_set1_pd(x); }
+static inline vd vadd(vd a, vd b) { return _mm256_add_pd(a, b); }
+static inline vd vsub(vd a, vd b) { return _mm256_sub_pd(a, b); }
+static inline vd vmul(vd a, vd b) { return _mm256_mul_pd(a, b); }
+static inline vd vdiv(vd a, vd b) { return _mm256_div_pd(a, b); }
+#ifdef __FMA__
+static inline vd vfmadd(vd a, vd b, vd c) { return _mm256_fmadd_pd(a, b, c); }
+#else
+static inline vd vfmadd(vd a, vd b, vd c) { return _mm256_add_pd(_mm256_mul_pd(a, b), c); }
+#endif
+static inline vd vsqrt(vd a) { return _mm256_sqrt_pd(a); }
+static inline vd vmin(vd a, vd b) { return _mm256_min_pd(a, b); }
+static inline vd vrint(vd a) { return _mm256_round_pd(a, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC); }
+static inline vd vfloor(vd a) { return _mm256_floor_pd(a); }
+static inline vm vlt(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_LT_OQ); }
+static inline vm vle(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_LE_OQ); }
+static inline vm vneq(vd a, vd b) { return _mm256_cmp_pd(a, b, _CMP_NEQ_OQ); }
+static inline vm vand(vm a, vm b) { return _mm256_and_pd(a, b); }
+static inline vm vfirst(int n) { return _mm256_cmp_pd(_mm256_set_pd(3, 2, 1, 0), _mm256_set1_pd(n), _CMP_LT_OQ); }
+static inline vd vselect(vm m, vd a, vd b) { return _mm256_blendv_pd(b, a, m); }
+static inline vd vkeep(vm m, vd a) { return _mm256_and_pd(m, a); }
+static inline vi vloadi(const int *p) { return _mm_loadu_si128((const __m128i *)p); }
+static inline vi vtoint(vd a) { return _mm256_cvttpd_epi32(a); }
+static inline vd vgather(const double *base, vi idx) { return _mm256_i32gather_pd(base, idx, 8); }
+static inline vd vloadn(const double *p, int n) { return _mm256_maskload_pd(p, _mm256_castpd_si256(vfirst(n))); }
+static inline vd vload(const double *p) { return _mm256_loadu_pd(p); }
+static inline vd vload(const float *p) { return _mm256_cvtps_pd(_mm_loadu_ps(p)); }
+static inline void vstoren(double *p, vd a, int n) { _mm256_maskstore_pd(p, _mm256_castpd_si256(vfirst(n)), a); }
+static inline double vsum(vd a) {
+    __m128d lo = _mm_add_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_add_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+static inline double vminval(vd a) {
+    __m128d lo = _mm_min_pd(_mm256_castpd256_pd128(a), _mm256_extractf128_pd(a, 1));
+    return _mm_cvtsd_f64(_mm_min_sd(lo, _mm_unpackhi_pd(lo, lo)));
+}
+
+#else // scalar fallback: one "lane"
+#define SIMD_WIDTH 1
+#define SIMD_NAME "scalar"
+typedef double vd;
+typedef bool vm;
+typedef int vi;
+static inline vd vset1(double x) { return x; }
+static inline vd vadd(vd a, vd b) { return a + b; }
+static inline vd vsub(vd a, vd b) { return a - b; }
+static inline vd vmul(vd a, vd b) { return a * b; }
+static inline vd vdiv(vd a, vd b) { return a / b; }
+static inline vd vfmadd(vd a, vd b, vd c) { return a*b + c; }
+static inline vd vsqrt(vd a) { return sqrt(a); }
+static inline vd vmin(vd a, vd b) { return a < b ? a : b; }
+static inline vd vrint(vd a) { return rint(a); }
+static inline vd vfloor(vd a) { return floor(a); }
+static inline vm vlt(vd a, vd b) { return a < b; }
+static inline vm vle(vd a, vd b) { return a <= b; }
+static inline vm vneq(vd a, vd b) { return a != b; }
+static inline vm vand(vm a, vm b) { return a && b; }
+static inline vm vfirst(int n) { return n > 0; }
+static inline vd vselect(vm m, vd a, vd b) { return m ? a : b; }
+static inline vd vkeep(vm m, vd a) { return m ? a : 0.0; }
+static inline vi vloadi(const int *p) { return *p; }
+static inline vi vtoint(vd a) { return (int)a; }
+static inline vd vgather(const double *base, vi idx) { return base[idx]; }
+static inline vd vloadn(const double *p, int n) { return n > 0 ? *p : 0.0; }
+static inline vd vload(const double *p) { return *p; }
+static inline vd vload(const float *p) { return *p; }
+static inline void vstoren(double *p, vd a, int n) { if (n > 0) *p = a; }
+static inline double vsum(vd a) { return a; }
+static inline double vminval(vd a) { return a; }
+#endif
+
+// erfc(x) table for the vector Ewald kernel: cubic Hermite pieces on [0, ERFC_TABLE_XMAX)
+// with spacing 1/ERFC_TABLE_N, stored as 4 blocks of coefficients c0..c3 (|error| ~ 1e-13).
+// x = alpha*r stays below 3.5 inside the cutoff.
+#define ERFC_TABLE_XMAX 6.0
+#define ERFC_TABLE_N 512
+
+void setupErfcTable(System &system) {
+    const int npts = (int)(ERFC_TABLE_XMAX*ERFC_TABLE_N);
+    const double h = 1.0/ERFC_TABLE_N;
+    vector<double> &tab = system.grids.erfc_table;
+    tab.resize(4*npts);
+    for (int n=0; n<npts; n++) {
+        double x0 = n*h, x1 = (n+1)*h;
+        double f0 = erfc(x0), f1 = erfc(x1);
+        double d0 = -2.0/sqrt(M_PI)*exp(-x0*x0)*h, d1 = -2.0/sqrt(M_PI)*exp(-x1*x1)*h; // df/dt, t in [0,1)
+        tab[n] = f0;
+        tab[npts + n] = d0;
+        tab[2*npts + n] = 3.0*(f1 - f0) - 2.0*d0 - d1;
+        tab[3*npts + n] = 2.0*(f0 - f1) + d0 + d1;
+    }
+}
+
+static inline vd verfc(const double *tab, vd x) {
+#if SIMD_WIDTH > 1
+    const int npts = (int)(ERFC_TABLE_XMAX*ERFC_TABLE_N);
+    vd s = vmul(vmin(x, vset1(ERFC_TABLE_XMAX - 1.0/ERFC_TABLE_N)), vset1(ERFC_TABLE_N));
+    vd fl = vfloor(s);
+    vd t = vsub(s, fl);
+    vi n = vtoint(fl);
+    vd c = vgather(tab + 3*npts, n);
+    c = vfmadd(c, t, vgather(tab + 2*npts, n));
+    c = vfmadd(c, t, vgather(tab + npts, n));
+    return vfmadd(c, t, vgather(tab, n));
+#else
+    return erfc(x); // the real thing when there's no vector unit to feed
+#endif
+}
+
+// minimum-image displacement for box policy BOX (same steps as minimumImage2(), distance.cpp)
+template <int BOX>
+static inline void vminimage(const Pbc &pbc, vd &dx, vd &dy, vd &dz) {
+    const double (*B)[3] = pbc.basis;
+    const double (*R)[3] = pbc.reciprocal_basis;
+    if (BOX == BOX_ORTHO) {
+        dx = vsub(dx, vmul(vset1(B[0][0]), vrint(vmul(vset1(R[0][0]), dx))));
+        dy = vsub(dy, vmul(vset1(B[1][1]), vrint(vmul(vset1(R[1][1]), dy))));
+        dz = vsub(dz, vmul(vset1(B[2][2]), vrint(vmul(vset1(R[2][2]), dz))));
+    } else if (BOX == BOX_TRICLINIC) {
+        vd img[3];
+        for (int p=0; p<3; p++)
+            img[p] = vrint(vfmadd(vset1(R[2][p]), dz, vfmadd(vset1(R[1][p]), dy, vmul(vset1(R[0][p]), dx))));
+        dx = vsub(dx, vfmadd(vset1(B[2][0]), img[2], vfmadd(vset1(B[1][0]), img[1], vmul(vset1(B[0][0]), img[0]))));
+        dy = vsub(dy, vfmadd(vset1(B[2][1]), img[2], vfmadd(vset1(B[1][1]), img[1], vmul(vset1(B[0][1]), img[0]))));
+        dz = vsub(dz, vfmadd(vset1(B[2][2]), img[2], vfmadd(vset1(B[1][2]), img[1], vmul(vset1(B[0][2]), img[0]))));
+    }
+}
+
+// indices of the next (up to) SIMD_WIDTH partners; the unused lanes repeat b[0]
+static inline vi vpartners(const int *b, int k, int *idx) {
+    for (int p=0; p<SIMD_WIDTH; p++) idx[p] = b[p < k ? p : 0];
+    return vloadi(idx);
+}
+
+// atom types (row offsets into the mixed pair tables) of the next (up to) SIMD_WIDTH partners,
+// which start at flat index b0 if b is NULL; the unused lanes repeat the first one
+static inline vi vtypes(const int *type, const int *b, int b0, int k, int *idx) {
+    for (int p=0; p<SIMD_WIDTH; p++) idx[p] = type[b ? b[p < k ? p : 0] : b0 + (p < k ? p : 0)];
+    return vloadi(idx);
+}
+
+// LJ 12-6 energy of flat atom a with the n partner atoms b[] (mixed parameters from the
+// atom type tables, no FH). pairs with sig or eps = 0, or beyond the cutoff with rd_lrc on, give nothing.
+// *rmin2 gets the smallest r^2 of the pairs with nonzero sig/eps (for the auto-reject test).
+template <int BOX>
+double lj_pairs_simd_box(System &system, int a, const int *b, int n, double *rmin2) {
+    const double *X = &system.atoms.x[0], *Y = &system.atoms.y[0], *Z = &system.atoms.z[0];
+    const int *T = &system.atoms.type[0];
+    const int row = T[a]*system.atomtypes.n;
+    const double *E = &system.atomtypes.mix_eps[row], *S6 = &system.atomtypes.mix_sig6[row], *S12 = &system.atomtypes.mix_sig12[row];
+    const vd xa = vset1(X[a]), ya = vset1(Y[a]), za = vset1(Z[a]);
+    const vd zero = vset1(0.0), one = vset1(1.0), four = vset1(4.0), inf = vset1(HUGE_VAL);
+    const vd cut2 = vset1(system.constants.rd_lrc ? system.pbc.cutoff*system.pbc.cutoff : HUGE_VAL);
+    vd sum = zero, rmin = inf;
+    int idx[SIMD_WIDTH], tdx[SIMD_WIDTH];
+
+    for (int m=0; m<n; m+=SIMD_WIDTH) {
+        const int k = (n-m < SIMD_WIDTH) ? n-m : SIMD_WIDTH;
+        vi vb = vpartners(b+m, k, idx);
+        vi vt = vtypes(T, b+m, 0, k, tdx);
+        vd dx = vsub(xa, vgather(X, vb)), dy = vsub(ya, vgather(Y, vb)), dz = vsub(za, vgather(Z, vb));
+        vminimage<BOX>(system.pbc, dx, dy, dz);
+        vd r2 = vfmadd(dz, dz, vfmadd(dy, dy, vmul(dx, dx)));
+
+        vd eps = vgather(E, vt), sig6 = vgather(S6, vt);
+        vm use = vand(vfirst(k), vand(vneq(eps, zero), vneq(sig6, zero)));
+        rmin = vmin(rmin, vselect(use, r2, inf));
+        use = vand(use, vle(r2, cut2));
+
+        vd ir6 = vdiv(one, r2);
+        ir6 = vmul(ir6, vmul(ir6, ir6));
+        vd e = vmul(vmul(four, eps), vmul(ir6, vsub(vmul(vgather(S12, vt), ir6), sig6)));
+        sum = vadd(sum, vkeep(use, e));
+    }
+    *rmin2 = vminval(rmin);
+    return vsum(sum);
+}
+
+// Ewald real-space energy q_a q_b erfc(alpha r)/r of flat atom a with the n partner atoms b[]
+// (other molecules only, no FH). pairs at or beyond the cutoff give nothing.
+// needs setupErfcTable() to have been called (main.cpp)
+template <int BOX>
+double es_real_pairs_simd_box(System &system, int a, const int *b, int n) {
+#if SIMD_WIDTH > 1
+    const double *tab = &system.grids.erfc_table[0];
+#else
+    const double *tab = NULL;
+#endif
+    const double *X = &system.atoms.x[0], *Y = &system.atoms.y[0], *Z = &system.atoms.z[0];
+    const double *Q = &system.atoms.C[0];
+    const vd xa = vset1(X[a]), ya = vset1(Y[a]), za = vset1(Z[a]), qa = vset1(Q[a]);
+    const vd alpha = vset1(system.constants.ewald_alpha);
+    const vd cut2 = vset1(system.pbc.cutoff*system.pbc.cutoff);
+    vd sum = vset1(0.0);
+    int idx[SIMD_WIDTH];
+
+    for (int m=0; m<n; m+=SIMD_WIDTH) {
+        const int k = (n-m < SIMD_WIDTH) ? n-m : SIMD_WIDTH;
+        vi vb = vpartners(b+m, k, idx);
+        vd dx = vsub(xa, vgather(X, vb)), dy = vsub(ya, vgather(Y, vb)), dz = vsub(za, vgather(Z, vb));
+        vminimage<BOX>(system.pbc, dx, dy, dz);
+        vd r2 = vfmadd(dz, dz, vfmadd(dy, dy, vmul(dx, dx)));
+        vm use = vand(vfirst(k), vlt(r2, cut2));
+
+        vd r = vsqrt(r2);
+        vd e = vdiv(vmul(vmul(qa, vgather(Q, vb)), verfc(tab, vmul(alpha, r))), r);
+        sum = vadd(sum, vkeep(use, e));
+    }
+    return vsum(sum);
+}
+
+// LJ forces between flat atom a and the contiguous atoms b0..b1-1 (the lj_force() pairs).
+// the force on a is added to fx/fy/fz[a], and taken from fx/fy/fz[b].
+template <int BOX>
+void lj_force_range_simd_box(System &system, int a, int b0, int b1, double *fx, double *fy, double *fz) {
+    const double *X = &system.atoms.x[0], *Y = &system.atoms.y[0], *Z = &system.atoms.z[0];
+    const int *T = &system.atoms.type[0];
+    const int row = T[a]*system.atomtypes.n;
+    const double *E = &system.atomtypes.mix_eps[row], *S6 = &system.atomtypes.mix_sig6[row], *S12 = &system.atomtypes.mix_sig12[row];
+    const vd xa = vset1(X[a]), ya = vset1(Y[a]), za = vset1(Z[a]);
+    const vd zero = vset1(0.0), one = vset1(1.0), two = vset1(2.0), c24 = vset1(24.0);
+    const vd cut2 = vset1(system.constants.rd_lrc ? system.pbc.cutoff*system.pbc.cutoff : HUGE_VAL);
+    vd fax = zero, fay = zero, faz = zero;
+    int tdx[SIMD_WIDTH];
+
+    for (int b=b0; b<b1; b+=SIMD_WIDTH) {
+        const int k = (b1-b < SIMD_WIDTH) ? b1-b : SIMD_WIDTH;
+        vi vt = vtypes(T, NULL, b, k, tdx);
+        vd dx = vsub(xa, vloadn(X+b, k)), dy = vsub(ya, vloadn(Y+b, k)), dz = vsub(za, vloadn(Z+b, k));
+        vminimage<BOX>(system.pbc, dx, dy, dz);
+        vd r2 = vfmadd(dz, dz, vfmadd(dy, dy, vmul(dx, dx)));
+
+        vd eps = vgather(E, vt), sig6 = vgather(S6, vt);
+        vm use = vand(vfirst(k), vand(vand(vneq(eps, zero), vneq(sig6, zero)), vle(r2, cut2)));
+
+        // 24 eps (2 s^12/r^14 - s^6/r^8)
+        vd ir2 = vdiv(one, r2);
+        vd ir6 = vmul(ir2, vmul(ir2, ir2));
+        vd s6 = vmul(sig6, ir6), s12 = vmul(vgather(S12, vt), vmul(ir6, ir6));
+        vd g = vkeep(use, vmul(vmul(vmul(c24, eps), vsub(vmul(two, s12), s6)), ir2));
+
+        vd gx = vmul(g, dx), gy = vmul(g, dy), gz = vmul(g, dz);
+        fax = vadd(fax, gx); fay = vadd(fay, gy); faz = vadd(faz, gz);
+        vstoren(fx+b, vsub(vloadn(fx+b, k), gx), k);
+        vstoren(fy+b, vsub(vloadn(fy+b, k), gy), k);
+        vstoren(fz+b, vsub(vloadn(fz+b, k), gz), k);
+    }
+    fx[a] += vsum(fax); fy[a] += vsum(fay); fz[a] += vsum(faz);
+}
+
+void lj_force_range_simd(System &system, int a, int b0, int b1, double *fx, double *fy, double *fz) {
+    BOX_DISPATCH(system, lj_force_range_simd_box, system, a, b0, b1, fx, fy, fz);
+}
+
+/* One block row of the stored dipole tensor (see amatrix_reserve()) against the dipoles:
+field[p] -= sum_{j0 <= j < j1} sum_q A_ij[p][q] mu_j[q].
+mu9 holds each dipole three times over (9 per atom), so it lines up element for element
+with the 3x3 blocks and the row is one long multiply-add of two contiguous arrays. Element
+n of the row belongs to output component (n mod 9)/3; nine vector accumulators cover a
+period of 9 x SIMD_WIDTH elements, so every lane always feeds the same component. The
+blocks may be float, widened on load; the sums are double. */
+template <typename T>
+void amatrix_row_simd(const T *row, const double *mu9, int j0, int j1, double *field) {
+#if SIMD_WIDTH == 1
+    // no vectors: plain 3x3 block products, reading one copy of each dipole
+    double f0=0, f1=0, f2=0;
+    for (int j=j0; j<j1; j++) {
+        const T *A = row + 9*j;
+        const double *m = mu9 + 9*j;
+        f0 += A[0]*m[0] + A[1]*m[1] + A[2]*m[2];
+        f1 += A[3]*m[0] + A[4]*m[1] + A[5]*m[2];
+        f2 += A[6]*m[0] + A[7]*m[1] + A[8]*m[2];
+    }
+    field[0] -= f0; field[1] -= f1; field[2] -= f2;
+#else
+    const T *A = row + 9*j0;
+    const double *m = mu9 + 9*j0;
+    const int n = 9*(j1-j0);
+    const int period = 9*SIMD_WIDTH;
+    const int nv = n - n % period;
+    double f[3] = {0,0,0}, lanes[SIMD_WIDTH];
+    vd acc[9];
+    int c, k, l;
+
+    for (k=0; k<9; k++) acc[k] = vset1(0.0);
+    for (c=0; c<nv; c+=period)
+        for (k=0; k<9; k++)
+            acc[k] = vfmadd(vload(A + c + k*SIMD_WIDTH), vload(m + c + k*SIMD_WIDTH), acc[k]);
+
+    // lane l of accumulator k holds elements k*SIMD_WIDTH+l (mod 9) of each period
+    for (k=0; k<9; k++) {
+        vstoren(lanes, acc[k], SIMD_WIDTH);
+        for (l=0; l<SIMD_WIDTH; l++)
+            f[((k*SIMD_WIDTH + l) % 9)/3] += lanes[l];
+    }
+    for (c=nv; c<n; c++)
+        f[(c % 9)/3] += A[c]*m[c];
+
+    field[0] -= f[0]; field[1] -= f[1]; field[2] -= f[2];
+#endif
+}
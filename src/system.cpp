@@ -12,6 +12,10 @@ class System {
 		System();
 		vector<Molecule> molecules; // added 2-5-17
 		vector<Molecule> proto; // prototypes (i.e. sorbate molecules which can be moved/inserted/removed
+        // MC molecule bookkeeping (setupMovables()). one list per prototype, plus a last one for
+        // movable molecules that match no prototype (displaced but never inserted)
+        vector<vector<int>> movables; // indices into molecules of the movable ones (Molecule::protoid, slot)
+        vector<vector<Molecule>> spares; // removed molecules, kept so inserts (and a rejected remove) reuse their storage
 		Constants constants;
 		Pbc pbc;
         Stats stats;
@@ -25,19 +29,24 @@ class System {
         int n_histogram_bins=0;
 				double hist_resolution=0.7; // default 0.7 A
         Grid grids;
+        Cells cells;
+        AtomArrays atoms;
+        AtomTypes atomtypes;
+        vector<vector<double>> bodies; // rigid-body site templates, 3 per site relative to the COM (Molecule::body)
+        Kernels kernels;
 				FilePointer file_pointers;
 
         // defines the "previous checkpoint" time object
         std::chrono::time_point<std::chrono::system_clock> previous_checkpoint = std::chrono::system_clock::now();
 
         // a function for de-bugging. Prints the current datetime and a string of text supplied in code.
-        void checkpoint(string thetext) {
+        void checkpoint(const char *thetext) {
             if (constants.checkpoints_option) {
             std::chrono::time_point<std::chrono::system_clock> now = std::chrono::system_clock::now();
             std::time_t thetime = std::chrono::system_clock::to_time_t(now);
             double time_elapsed = (std::chrono::duration_cast<std::chrono::microseconds>(now - previous_checkpoint).count()) /1000.0; // in ms
 
-            printf("\nCheckpoint: %s ---> %.4f ms from last:  %s \n",std::ctime(&thetime), time_elapsed  , thetext.c_str());
+            printf("\nCheckpoint: %s ---> %.4f ms from last:  %s \n",std::ctime(&thetime), time_elapsed  , thetext);
             previous_checkpoint = std::chrono::system_clock::now();
             }
         }
@@ -108,6 +108,85 @@ double * centerOfMass(System &system) {
 }
 
 
+/* RIGID BODIES
+A movable molecule with more than one site is stored as its COM, a unit quaternion q and
+a site template in system.bodies (offsets from the COM at q = identity), shared with its
+prototype when the shapes match. rigidBodyPlace() regenerates the sites with one rotation
+matrix, so a rotation move is a quaternion product and a rejected move only has to put
+back com and q. */
+void rigidBodyPlace(System &system, int molid) {
+    Molecule &mol = system.molecules[molid];
+    if (mol.body < 0) return;
+    const double *b = &system.bodies[mol.body][0];
+    double R[3][3];
+    quatMatrix(mol.q, R);
+    for (int i=0; i<mol.atoms.size(); i++)
+        for (int p=0; p<3; p++)
+            mol.atoms[i].pos[p] = mol.com[p] + R[p][0]*b[3*i] + R[p][1]*b[3*i+1] + R[p][2]*b[3*i+2];
+}
+
+// template id for mol as it is now (orientation q = identity): an existing template if one
+// has the same sites to within 1e-6 A, else a new one
+int rigidBodyTemplate(System &system, Molecule &mol) {
+    vector<double> b(3*mol.atoms.size());
+    mol.calc_center_of_mass();
+    for (int i=0; i<mol.atoms.size(); i++)
+        for (int p=0; p<3; p++) b[3*i+p] = mol.atoms[i].pos[p] - mol.com[p];
+    for (int t=0; t<system.bodies.size(); t++) {
+        if (system.bodies[t].size() != b.size()) continue;
+        int same = 1;
+        for (int n=0; n<b.size(); n++)
+            if (fabs(system.bodies[t][n] - b[n]) > 1e-6) { same = 0; break; }
+        if (same) return t;
+    }
+    system.bodies.push_back(b);
+    return system.bodies.size()-1;
+}
+
+// templates for the prototypes and the movable molecules. not in atomic MD, where the
+// sites of a molecule move on their own
+void setupRigidBodies(System &system) {
+    if (system.constants.mode == "md" && system.constants.md_mode == MD_ATOMIC) return;
+    for (int i=0; i<system.proto.size(); i++)
+        if (system.proto[i].atoms.size() > 1)
+            system.proto[i].body = rigidBodyTemplate(system, system.proto[i]);
+    for (int i=0; i<system.molecules.size(); i++) {
+        if (system.molecules[i].frozen || system.molecules[i].atoms.size() < 2) continue;
+        system.molecules[i].body = rigidBodyTemplate(system, system.molecules[i]);
+        system.molecules[i].q[0] = 1; system.molecules[i].q[1] = system.molecules[i].q[2] = system.molecules[i].q[3] = 0;
+        rigidBodyPlace(system, i);
+    }
+    printf("RIGID BODY TEMPLATES: %i\n", (int)system.bodies.size());
+}
+
+// index of the prototype molecule i is a copy of (by name); -1 if none
+int moleculeProtoId(System &system, int i) {
+    for (int j=0; j<system.proto.size(); j++)
+        if (system.molecules[i].name == system.proto[j].name) return j;
+    return -1;
+}
+
+// the system.movables (and system.spares) list a molecule of prototype protoid goes in
+int movableList(System &system, int protoid) {
+    return protoid >= 0 ? protoid : (int)system.proto.size();
+}
+
+// index the movable molecules by prototype, so MC moves pick one without searching
+// and inserts/removes keep the index up to date (moves.cpp)
+void setupMovables(System &system) {
+    system.movables.assign(system.proto.size()+1, vector<int>());
+    system.spares.assign(system.proto.size()+1, vector<Molecule>());
+    for (int j=0; j<system.proto.size(); j++) system.proto[j].protoid = j;
+    for (int i=0; i<system.molecules.size(); i++) {
+        Molecule &mol = system.molecules[i];
+        if (mol.frozen) continue;
+        mol.protoid = moleculeProtoId(system, i);
+        vector<int> &list = system.movables[movableList(system, mol.protoid)];
+        mol.slot = list.size();
+        list.push_back(i);
+    }
+}
+
 /* CHECK IF MOLECULE IS IN BOX AND MOVE BACK IN IF NOT */
 void checkInTheBox(System &system, int i) { // i is molecule id passed in function call.
 
@@ -298,9 +377,74 @@ else {
             for (int n=0;n<3;n++) system.molecules[i].diffusion_corr[n] -= system.molecules[i].com[n] - tmp_com[n];
         }
 } // end if non-90/90/90
+    rigidBodyPlace(system, i); // the sites exactly where com and q put them
 } // end pbc function
 
 
+// id of an atom name (see AtomTypes); -1 if no atom has it
+int atomNameId(System &system, const string &name) {
+    for (int n=0; n<system.atomtypes.names.size(); n++)
+        if (system.atomtypes.names[n] == name) return n;
+    return -1;
+}
+
+// (re)build the mixed LJ pair tables for all types
+void atomTypeTables(System &system) {
+    AtomTypes &at = system.atomtypes;
+    const int n = at.n;
+    at.mix_eps.resize(n*n); at.mix_sig.resize(n*n); at.mix_sig6.resize(n*n); at.mix_sig12.resize(n*n);
+    for (int t=0; t<n; t++)
+    for (int u=0; u<n; u++) {
+        // same mixing rules as before the tables: exact for like pairs
+        double eps = at.eps[t], sig = at.sig[t];
+        if (eps != at.eps[u])
+            eps = sqrt(eps * at.eps[u]);
+        if (sig != at.sig[u])
+            sig = 0.5 * (sig + at.sig[u]);
+        double sig6 = sig*sig;
+        sig6 *= sig6*sig6;
+        at.mix_eps[t*n+u] = eps;
+        at.mix_sig[t*n+u] = sig;
+        at.mix_sig6[t*n+u] = sig6;
+        at.mix_sig12[t*n+u] = sig6*sig6;
+    }
+}
+
+// the type id for an atom with this name and LJ parameters; new types are registered
+int atomTypeId(System &system, const string &name, double eps, double sig) {
+    AtomTypes &at = system.atomtypes;
+    int name_id = atomNameId(system, name);
+    if (name_id >= 0)
+        for (int t=0; t<at.n; t++)
+            if (at.name_id[t] == name_id && at.eps[t] == eps && at.sig[t] == sig) return t;
+
+    if (name_id < 0) {
+        at.names.push_back(name);
+        name_id = at.names.size()-1;
+    }
+    at.name_id.push_back(name_id);
+    at.eps.push_back(eps);
+    at.sig.push_back(sig);
+    at.n++;
+    atomTypeTables(system);
+    return at.n-1;
+}
+
+// give every atom (molecules and prototypes) its type id, e.g. after the LJ parameters were overridden
+void atomTypesAssign(System &system) {
+    int i, j;
+    for (i=0; i<system.molecules.size(); i++)
+        for (j=0; j<system.molecules[i].atoms.size(); j++) {
+            Atom &atom = system.molecules[i].atoms[j];
+            atom.type = atomTypeId(system, atom.name, atom.eps, atom.sig);
+        }
+    for (i=0; i<system.proto.size(); i++)
+        for (j=0; j<system.proto[i].atoms.size(); j++) {
+            Atom &atom = system.proto[i].atoms[j];
+            atom.type = atomTypeId(system, atom.name, atom.eps, atom.sig);
+        }
+}
+
 void addAtomToProto(System &system, int protoid, string name, string molname, string MF, double x, double y, double z, double mass, double charge, double polarizability, double epsilon, double sigma) {
     // initialize
     Atom atom;
@@ -330,6 +474,7 @@ void addAtomToProto(System &system, int protoid, string name, string molname, st
     atom.polar = polarizability;
     atom.eps = epsilon;
     atom.sig = sigma;
+    atom.type = atomTypeId(system, name, epsilon, sigma);
 
     system.proto[protoid].mass += atom.m;
     // send it over
@@ -713,6 +858,28 @@ void moleculePrintout(System &system) {
     // END MOLECULE PRINTOUT
 }
 
+// pair cutoff for the starting cell and the Ewald alpha and kmax that go with it (setupBox()).
+// volume moves keep all three (defineBox()); changeVolumeMove() rejects a box too small for a cutoff from the input
+void setupCutoff(System &system) {
+    system.pbc.calcCutoff();
+    const int model = system.constants.potential_form;
+    const int_fast8_t ewald = system.constants.ewald_es && (model == POTENTIAL_LJES || model == POTENTIAL_LJESPOLAR || model == POTENTIAL_COMMYES || model == POTENTIAL_COMMYESPOLAR);
+    if (system.pbc.cutoff_fixed && ewald && system.stats.count_frozens > 0) {
+        // alpha = 3.5/cutoff, and frozen atoms are left out of the reciprocal sum, so the
+        // framework-sorbate ES would change with the cutoff (however big kmax is)
+        printf("ERROR: the cutoff option can't be used with Ewald electrostatics (ewald_es on) and frozen atoms. Exiting.\n");
+        exit(1);
+    }
+    if (system.pbc.cutoff_fixed && system.constants.all_pbc && system.pbc.cutoff > system.pbc.max_cutoff*(1.0 + 1e-10)) {
+        printf("ERROR: cutoff = %f A is more than half the narrowest width of the box (%f A), which breaks minimum image. Exiting.\n", system.pbc.cutoff, 2.0*system.pbc.max_cutoff);
+        exit(1);
+    }
+    system.constants.ewald_alpha = 3.5/system.pbc.cutoff;
+    // the default cutoff gives alpha*(shortest vector) = 7 = the default kmax. a shorter cutoff
+    // raises alpha, so kmax grows with it to keep the reciprocal sum converged
+    system.constants.ewald_kmax = std::max(7.0, ceil(system.constants.ewald_alpha*system.pbc.shortest_vector - 1e-6));
+}
+
 void setupBox(System &system) {
     if (system.pbc.alpha == 90 && system.pbc.beta == 90 && system.pbc.gamma == 90) {
 	system.pbc.x_max = system.pbc.x_length/2.0;
@@ -724,11 +891,62 @@ void setupBox(System &system) {
     }
     system.pbc.calcVolume();
     system.pbc.calcRecip();
-    system.pbc.calcCutoff();
-    system.constants.ewald_alpha = 3.5/system.pbc.cutoff;
+    setupCutoff(system);
     system.pbc.calcBoxVertices();
     system.pbc.calcPlanes();
     system.pbc.printBasis();
+
+    // minimum-image kernel for the pair loops (distance.cpp). a cell is orthorhombic if its
+    // basis is diagonal up to round-off (cos 90 from calcNormalBasis()). NPT volume moves
+    // scale the cell but keep its shape, so this holds for the whole run
+    int_fast8_t diagonal = 1;
+    for (int p=0; p<3; p++)
+        for (int q=0; q<3; q++)
+            if (p != q && fabs(system.pbc.basis[p][q]) > 1e-10*fabs(system.pbc.basis[p][p])) diagonal = 0;
+    if (!system.constants.all_pbc)
+        system.pbc.box_policy = BOX_NONE;
+    else if (diagonal)
+        system.pbc.box_policy = BOX_ORTHO;
+    else
+        system.pbc.box_policy = BOX_TRICLINIC;
+    printf("box policy: %s\n", system.pbc.box_policy == BOX_ORTHO ? "orthorhombic" : system.pbc.box_policy == BOX_TRICLINIC ? "triclinic" : "none");
+}
+
+/* The dipole solve of an MC step saves the dip, efield and efield_induced_change of the
+sites it is about to overwrite -- all of them for a full solve, the region for
+polarization_local() -- and revertToCheckpoint() puts them back. Sites are flat indices
+at the time of the solve: a rejected remove appends its molecule again and a rejected
+insert drops the last one, so they still point at the same atoms (or past the end). */
+void polarSave(System &system, int a) {
+    const Atom &atom = system.molecules[system.atommap[a][0]].atoms[system.atommap[a][1]];
+    system.last.polar_sites.push_back(a);
+    for (int p=0; p<3; p++) {
+        system.last.polar_values.push_back(atom.dip[p]);
+        system.last.polar_values.push_back(atom.efield[p]);
+        system.last.polar_values.push_back(atom.efield_induced_change[p]);
+    }
+}
+
+// every site, before a full solve -- or the fused sweep that makes its field -- overwrites them.
+// only the first full solve of an MC step saves, so the values kept are from before the step
+void polarSaveAll(System &system) {
+    if (system.constants.mode != "mc" || !system.last.polar_sites.empty()) return;
+    for (int a=0; a<system.atoms.x.size(); a++) polarSave(system, a);
+}
+
+void polarRestore(System &system) {
+    const int N = system.atoms.x.size();
+    for (int n=0; n<system.last.polar_sites.size(); n++) {
+        const int a = system.last.polar_sites[n];
+        if (a >= N) continue; // a molecule that was inserted and taken out again
+        Atom &atom = system.molecules[system.atommap[a][0]].atoms[system.atommap[a][1]];
+        const double *v = &system.last.polar_values[9*n];
+        for (int p=0; p<3; p++) {
+            atom.dip[p] = v[3*p];
+            atom.efield[p] = v[3*p+1];
+            atom.efield_induced_change[p] = v[3*p+2];
+        }
+    }
 }
 
 void setCheckpoint(System &system) {
@@ -744,6 +962,8 @@ void setCheckpoint(System &system) {
         system.last.es_self = system.stats.es_self.value;
         system.last.es_real = system.stats.es_real.value;
         system.last.es_recip = system.stats.es_recip.value;
+        system.last.ewald_sf_re = system.constants.ewald_sf_re;
+        system.last.ewald_sf_im = system.constants.ewald_sf_im;
     system.last.polar = system.stats.polar.value;
     system.last.potential = system.stats.potential.value;
         // VOLUME
@@ -764,6 +984,10 @@ void setCheckpoint(System &system) {
 
         // N
     system.last.total_atoms = system.constants.total_atoms;
+
+        // DIPOLES: saved by the solve itself, for just the sites it touches (polarSave())
+    system.last.polar_sites.clear();
+    system.last.polar_values.clear();
 }
 
 void revertToCheckpoint(System &system) {
@@ -779,6 +1003,8 @@ void revertToCheckpoint(System &system) {
         system.stats.es_self.value = system.last.es_self;
         system.stats.es_real.value = system.last.es_real;
         system.stats.es_recip.value = system.last.es_recip;
+        system.constants.ewald_sf_re = system.last.ewald_sf_re;
+        system.constants.ewald_sf_im = system.last.ewald_sf_im;
     system.stats.polar.value = system.last.polar;
     system.stats.potential.value = system.last.potential;
         // VOLUME
@@ -800,6 +1026,8 @@ void revertToCheckpoint(System &system) {
         // N
     system.constants.total_atoms = system.last.total_atoms;
 
+        // DIPOLES (the next solve starts from these; see init_dipoles())
+    polarRestore(system);
 }
 
 void initialize(System &system) {
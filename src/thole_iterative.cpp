@@ -5,12 +5,160 @@
 
 #define MAX_ITERATION_COUNT 128
 
+/* Matrix-free contraction (polar_matrix_free on).
+Instead of a stored 3N x 3N A matrix, each dipole pair's Thole tensor block is
+rebuilt from the positions whenever the contraction needs it, for the pairs
+within the cutoff only. thole_pairlist() keeps just the partner indices, so
+memory is O(N) rather than 9N^2 doubles. Atom indices are the atommap (= flat
+atom array) indices.
+*/
+
+// append the polarizable atoms within the cutoff of polarizable atom a (own molecule included) to pairs.
+// partners is scratch
+void thole_pairlist_row(System &system, int a, vector<int> &partners, vector<int> &pairs) {
+    int b, n;
+    double d[3];
+    const int i = system.atoms.mol[a];
+    cellPartners(system, a, 0, 1, partners);
+    for (b=system.atoms.start[i]; b<system.atoms.start[i+1]; b++)
+        if (b != a) partners.push_back(b);
+    for (n=0; n<partners.size(); n++) {
+        b = partners[n];
+        if (system.atoms.polar[b] == 0) continue; // no dipole, no field
+        if (getDistanceAtoms(system, a, b, d) < system.pbc.cutoff)
+            pairs.push_back(b);
+    }
+}
+
+// list, for each polarizable atom, the polarizable atoms within the cutoff (own molecule included).
+void thole_pairlist(System &system) {
+    int a;
+    vector<int> partners;
+    const int N = system.atoms.x.size();
+    vector<vector<int> > row_pairs(N); // rows are listed by the threads, then joined in order
+
+    #pragma omp parallel for schedule(dynamic, 16) firstprivate(partners)
+    for (a=0; a<N; a++) {
+        if (system.atoms.polar[a] == 0) continue; // its row is never contracted
+        thole_pairlist_row(system, a, partners, row_pairs[a]);
+    }
+
+    system.constants.thole_pair_start.resize(N+1);
+    system.constants.thole_pairs.clear();
+    for (a=0; a<N; a++) {
+        system.constants.thole_pair_start[a] = system.constants.thole_pairs.size();
+        system.constants.thole_pairs.insert(system.constants.thole_pairs.end(), row_pairs[a].begin(), row_pairs[a].end());
+    }
+    system.constants.thole_pair_start[N] = system.constants.thole_pairs.size();
+}
+
+// add -sum_b T_ab mu_b over the npairs partners b of atom a in pairs to field (the same
+// damped tensor as thole_amatrix(), made on the spot). mu_b is taken from x
+// (3 per atommap index) if given, otherwise from the atoms' dipoles
+template <int BOX>
+void thole_contract_pairs_box(System &system, int a, const int *pairs, int npairs, const double *x, double *field) {
+    const double l = system.constants.polar_damp;
+    const double l2 = l*l, l3 = l2*l;
+    const double MAXVALUE = 1.0e40;
+    double d[3], r, r2, ir, ir3, ir5, explr, damp1, damp2, ddotmu;
+    int b, n, p;
+
+    for (n=0; n<npairs; n++) {
+        b = pairs[n];
+        const double *mu = x ? x+3*b : system.molecules[system.atommap[b][0]].atoms[system.atommap[b][1]].dip;
+
+        r2 = getDistance2<BOX>(system, a, b, d);
+        r = sqrt(r2);
+        if (r == 0.)
+            ir3 = ir5 = MAXVALUE;
+        else {
+            ir = 1.0/r;
+            ir3 = ir*ir*ir;
+            ir5 = ir3*ir*ir;
+        }
+        explr = exp(-l*r);
+        damp1 = 1.0 - explr*(0.5*l2*r2 + l*r + 1.0);
+        damp2 = damp1 - explr*(l3*r2*r/6.0);
+
+        // T = -3 d d^T damp2/r^5 + I damp1/r^3
+        ddotmu = d[0]*mu[0] + d[1]*mu[1] + d[2]*mu[2];
+        for (p=0; p<3; p++)
+            field[p] -= damp1*ir3*mu[p] - 3.0*damp2*ir5*d[p]*ddotmu;
+    }
+}
+
+void thole_contract_pairs(System &system, int a, const int *pairs, int npairs, const double *x, double *field) {
+    BOX_DISPATCH(system, thole_contract_pairs_box, system, a, pairs, npairs, x, field);
+}
+
+// the same over a's row of thole_pairlist()
+void thole_contract_row(System &system, int a, const double *x, double *field) {
+    const int n0 = system.constants.thole_pair_start[a], n1 = system.constants.thole_pair_start[a+1];
+    thole_contract_pairs(system, a, system.constants.thole_pairs.data() + n0, n1 - n0, x, field);
+}
+
+// field -= sum_{j != i} A_ij mu_j along block row i of the stored A matrix (see amatrix_reserve()).
+// mu9 holds the dipoles tiled 9 per atommap index (tile_dipole()); the row product is amatrix_row_simd()
+void amatrix_contract(System &system, int i, const double *mu9, double *field) {
+    const size_t row = 9*(size_t)i*system.constants.A_capacity;
+    const int N = system.constants.total_atoms;
+    if (system.constants.polar_float_matrix) {
+        amatrix_row_simd(&system.constants.A_matrix_float[row], mu9, 0, i, field);
+        amatrix_row_simd(&system.constants.A_matrix_float[row], mu9, i+1, N, field);
+    } else {
+        amatrix_row_simd(&system.constants.A_matrix[row], mu9, 0, i, field);
+        amatrix_row_simd(&system.constants.A_matrix[row], mu9, i+1, N, field);
+    }
+}
+
+// write dipole mu of atom i into mu9: once for each row of a 3x3 block
+inline void tile_dipole(double *mu9, int i, const double *mu) {
+    for (int p=0; p<3; p++)
+        for (int q=0; q<3; q++)
+            mu9[9*i+3*p+q] = mu[q];
+}
+
+/* Flat copies, by atommap index, of what the sweeps read: the inner loops then run over
+plain arrays instead of going atommap -> molecules -> atoms for every pair. The atoms stay
+the master copy (dip/newdip are still written back to them for the convergence checks,
+palmo and the energy). */
+typedef struct _thole_flat {
+    vector<double> alpha; // polarizability
+    vector<double> E; // static field (+ self field), 3 per atom
+    aligned_vector mu9; // current dipoles, tiled (tile_dipole())
+} thole_flat_t;
+
+// polarizabilities and static fields, once per solve
+void thole_flat_load(System &system, thole_flat_t &flat) {
+    const int N = system.constants.total_atoms;
+    flat.alpha.resize(N);
+    flat.E.resize(3*N);
+    flat.mu9.resize(9*N);
+    for (int i=0; i<N; i++) {
+        const Atom &atom = system.molecules[system.atommap[i][0]].atoms[system.atommap[i][1]];
+        flat.alpha[i] = atom.polar;
+        for (int p=0; p<3; p++)
+            flat.E[3*i+p] = atom.efield[p] + atom.efield_self[p];
+    }
+}
+
+// the current dipoles, before each contraction
+void thole_flat_dipoles(System &system, thole_flat_t &flat) {
+    for (int i=0; i<system.constants.total_atoms; i++)
+        tile_dipole(&flat.mu9[0], i, system.molecules[system.atommap[i][0]].atoms[system.atommap[i][1]].dip);
+}
+
 //set them to alpha*E_static
+// with a warm start (only when iterating to polar_precision) atoms that already carry a dipole
+// -- the last accepted solution, see setCheckpoint()/revertToCheckpoint() -- keep it as the first guess
 void init_dipoles (System &system) {
 	unsigned int i, j, p;
+    const int_fast8_t warm = system.constants.polar_warm_start && system.constants.polar_precision > 0;
     //printf("polar gamma: %f\n", system.constants.polar_gamma);
     for (i=0; i<system.molecules.size(); i++) {
         for (j=0; j<system.molecules[i].atoms.size(); j++) {
+            if (warm && (system.molecules[i].atoms[j].dip[0] != 0 || system.molecules[i].atoms[j].dip[1] != 0 || system.molecules[i].atoms[j].dip[2] != 0))
+                continue; // new (inserted) molecules start at zero and get alpha*E
             for (p=0; p<3; p++) {
                 system.molecules[i].atoms[j].dip[p] =
                 system.molecules[i].atoms[j].polar *
@@ -27,48 +175,71 @@ void init_dipoles (System &system) {
 }
 // DONE
 
-void contract_dipoles (System &system, int * ranked_array ) {
-    unsigned int i, j, ii, jj, p, index, n, ti, tj, tk, tl;
+// one row of the contraction: the induced field at atom index from the current dipoles, and
+// its new dipole in newdip
+void contract_dipole_row (System &system, int index, thole_flat_t &flat) {
+    Atom &atom = system.molecules[system.atommap[index][0]].atoms[system.atommap[index][1]];
+    int p;
+
+    if ( flat.alpha[index] == 0 ) { //if not polar
+        //aa[index]->ef_induced[p] is already 0
+        for (p=0; p<3; p++) {
+            atom.newdip[p] = 0;
+            atom.dip[p] = 0;
+        }
+        return;
+    }
+    if (system.constants.polar_matrix_free)
+        thole_contract_row(system, index, NULL, atom.efield_induced);
+    else
+        amatrix_contract(system, index, &flat.mu9[0], atom.efield_induced);
+
+    /* dipole is the sum of the static and induced parts */
+    for(p = 0; p < 3; p++)
+        atom.newdip[p] = flat.alpha[index] * (flat.E[3*index+p] + atom.efield_induced[p]);
+}
 
-    for(i = 0; i < system.constants.total_atoms; i++) {
-        index = ranked_array[i]; //do them in the order of the ranked index
-        ii = index*3;
+void contract_dipoles (System &system, int * ranked_array, thole_flat_t &flat ) {
+    int i, index, p, color;
+    const int N = system.constants.total_atoms;
+    const int_fast8_t dense = !system.constants.polar_matrix_free;
+    const int_fast8_t red_black = system.constants.polar_red_black;
+    const int_fast8_t gs = !red_black && (system.constants.polar_gs || system.constants.polar_gs_ranked);
 
-        ti = system.atommap[index][0]; tj = system.atommap[index][1];
+    if (dense)
+        thole_flat_dipoles(system, flat);
 
-        if ( system.molecules[ti].atoms[tj].polar == 0 ) { //if not polar
-            //aa[index]->ef_induced[p] is already 0
-            for (n=0; n<3; n++) {
-                system.molecules[ti].atoms[tj].newdip[n] = 0;
-                system.molecules[ti].atoms[tj].dip[n] = 0;
-            }
-            continue;
-        }
-        for(j = 0; j < system.constants.total_atoms; j++) {
-            jj = j*3;
-            if(index != j) {
-                tk = system.atommap[j][0]; tl = system.atommap[j][1];
-                for(p = 0; p < 3; p++)
-                    system.molecules[ti].atoms[tj].efield_induced[p] -= 
-                    ((system.constants.A_matrix[ii+p]+jj)[0] * system.molecules[tk].atoms[tl].dip[0]) +
-                    ((system.constants.A_matrix[ii+p]+jj)[1] * system.molecules[tk].atoms[tl].dip[1]) +
-                    ((system.constants.A_matrix[ii+p]+jj)[2] * system.molecules[tk].atoms[tl].dip[2]);
-            }
-        } /* end j */
+    if (gs) {
+        for(i = 0; i < N; i++) {
+            index = ranked_array[i]; //do them in the order of the ranked index
+            contract_dipole_row(system, index, flat);
+
+            // gauss-seidel: the rows after this one see the new dipole
+            Atom &atom = system.molecules[system.atommap[index][0]].atoms[system.atommap[index][1]];
+            for(p = 0; p < 3; p++)
+                atom.dip[p] = atom.newdip[p];
+            if (dense) tile_dipole(&flat.mu9[0], index, atom.dip);
+        } /* end matrix multiply */
+        return;
+    }
 
-        /* dipole is the sum of the static and induced parts */
-        for(p = 0; p < 3; p++) {
-            system.molecules[ti].atoms[tj].newdip[p] = system.molecules[ti].atoms[tj].polar *
-            (system.molecules[ti].atoms[tj].efield[p] + 
-                system.molecules[ti].atoms[tj].efield_self[p] + 
-                system.molecules[ti].atoms[tj].efield_induced[p]);
-        
-            if (system.constants.polar_gs || system.constants.polar_gs_ranked) {
-                system.molecules[ti].atoms[tj].dip[p] = system.molecules[ti].atoms[tj].newdip[p];
-            }
+    /* jacobi: every row from the dipoles of the last sweep. red-black: the even rows, then the
+    odd rows against the new even dipoles. the rows of one pass are independent, so they go to
+    the threads; new dipoles are only put in place between passes, which keeps it deterministic */
+    const int stride = red_black ? 2 : 1;
+    for (color = 0; color < stride; color++) {
+        #pragma omp parallel for schedule(dynamic, 16)
+        for (i = color; i < N; i += stride)
+            contract_dipole_row(system, i, flat);
+
+        if (!red_black) break;
+        for (i = color; i < N; i += stride) {
+            Atom &atom = system.molecules[system.atommap[i][0]].atoms[system.atommap[i][1]];
+            for (p = 0; p < 3; p++)
+                atom.dip[p] = atom.newdip[p];
+            if (dense) tile_dipole(&flat.mu9[0], i, atom.dip);
         }
-
-    } /* end matrix multiply */
+    }
 
     return;
 }
@@ -100,6 +271,7 @@ void calc_dipole_rrms (System &system) {
     }
     */
 
+    #pragma omp parallel for schedule(static) private(j, p, carry)
     for (i=0; i<system.molecules.size(); i++) {
         for (j=0; j<system.molecules[i].atoms.size(); j++) {
             // mean square distance
@@ -152,32 +324,28 @@ int are_we_done_yet (System &system, int iteration_counter ) {
 	return 0;
 }
 
-void palmo_contraction (System &system, int * ranked_array ) {
-    unsigned int i, j, ii, jj, index, p, ti,tj, tk, tl;
+void palmo_contraction (System &system, int * ranked_array, thole_flat_t &flat ) {
+    unsigned int i, index, p, ti,tj;
     int N = system.constants.total_atoms;
 
+    if (!system.constants.polar_matrix_free)
+        thole_flat_dipoles(system, flat);
+
     /* calculate change in induced field due to this iteration */
+    // (each row only writes its own atom, so the rows go to the threads)
+    #pragma omp parallel for schedule(dynamic, 16) private(index, p, ti, tj)
     for(i = 0; i < N; i++) {
         index = ranked_array[i];
-        ii = index*3;
 
         ti = system.atommap[index][0]; tj = system.atommap[index][1];
 
         for (p=0; p<3; p++ )
             system.molecules[ti].atoms[tj].efield_induced_change[p] = -system.molecules[ti].atoms[tj].efield_induced[p];
 
-        for(j = 0; j < N; j++) {
-            jj = j*3;
-            if(index != j) {
-                tk = system.atommap[j][0]; tl = system.atommap[j][1];
-                for(p = 0; p < 3; p++) {
-                    system.molecules[ti].atoms[tj].efield_induced_change[p] -= 
-                        (system.constants.A_matrix[ii+p]+jj)[0] * system.molecules[tk].atoms[tl].dip[0] +
-                        (system.constants.A_matrix[ii+p]+jj)[1] * system.molecules[tk].atoms[tl].dip[1] +
-                        (system.constants.A_matrix[ii+p]+jj)[2] * system.molecules[tk].atoms[tl].dip[2];
-                }// end p
-            } 
-        }
+        if (system.constants.polar_matrix_free)
+            thole_contract_row(system, index, NULL, system.molecules[ti].atoms[tj].efield_induced_change);
+        else
+            amatrix_contract(system, index, &flat.mu9[0], system.molecules[ti].atoms[tj].efield_induced_change);
     }
 
     return;
@@ -231,6 +399,8 @@ int thole_iterative(System &system) {
 
     //set all dipoles to alpha*E_static * polar_gamma
     init_dipoles(system);
+    thole_flat_t flat;
+    thole_flat_load(system, flat);
 
 
     /* iterative solver of the dipole field equations */
@@ -286,7 +456,7 @@ int thole_iterative(System &system) {
         }
 
         // contract the dipoles with the field tensor (gauss-seidel/gs-ranked optional)
-        contract_dipoles(system, ranked_array);
+        contract_dipoles(system, ranked_array, flat);
 
         if ( system.constants.polar_rrms || system.constants.polar_precision > 0 )
             calc_dipole_rrms(system);
@@ -296,11 +466,11 @@ int thole_iterative(System &system) {
 
        // if we would be finished, contract once more to get the next induced field for palmo
         if (system.constants.polar_palmo && !keep_iterating) {
-            palmo_contraction(system, ranked_array);
+            palmo_contraction(system, ranked_array, flat);
         } 
 
         //new gs_ranking if needed
-        if ( system.constants.polar_gs_ranked && keep_iterating )
+        if ( system.constants.polar_gs_ranked && !system.constants.polar_red_black && keep_iterating )
             update_ranking(system, ranked_array);
 
         /* save the dipoles for the next pass */
@@ -319,3 +489,248 @@ int thole_iterative(System &system) {
 }
 
 
+/* Block-Jacobi preconditioned conjugate gradient (polar_pcg on).
+Solves A mu = E_static directly -- A is 1/alpha on the diagonal and the Thole tensors
+T_ab off it, symmetric and positive definite -- so there is no sweep order to rank.
+The preconditioner inverts A's diagonal blocks: one block (Cholesky) per molecule
+with up to PCG_BLOCK_MAX polarizable sites, so a sorbate's own sites are solved
+together, and 1/alpha per site on larger (framework) molecules. Indices are atommap
+(= flat atom) indices; non-polarizable atoms carry no dipole and stay at zero.
+*/
+
+#define PCG_BLOCK_MAX 8
+
+// damped dipole tensor block for minimum-image displacement d, |d| = r, damping l
+void thole_block(const double *d, double r, double l, double T[3][3]) {
+    const double l2 = l*l, l3 = l2*l;
+    const double MAXVALUE = 1.0e40;
+    double r2, ir, ir3, ir5, explr, damp1, damp2;
+    int p, q;
+
+    r2 = r*r;
+    if (r == 0.)
+        ir3 = ir5 = MAXVALUE;
+    else {
+        ir = 1.0/r;
+        ir3 = ir*ir*ir;
+        ir5 = ir3*ir*ir;
+    }
+    explr = exp(-l*r);
+    damp1 = 1.0 - explr*(0.5*l2*r2 + l*r + 1.0);
+    damp2 = damp1 - explr*(l3*r2*r/6.0);
+
+    for (p=0; p<3; p++)
+        for (q=0; q<3; q++)
+            T[p][q] = -3.0*d[p]*d[q]*damp2*ir5 + (p == q ? damp1*ir3 : 0);
+}
+
+// damped dipole tensor block T_ab between atoms a and b (as built in thole_amatrix())
+void thole_tensor(System &system, int a, int b, double T[3][3]) {
+    double d[3];
+    const double r = getDistanceAtoms(system, a, b, d);
+    thole_block(d, r, system.constants.polar_damp, T);
+}
+
+// y = A x over the polarizable rows; each row is independent so they are split over threads
+void thole_matvec(System &system, const vector<double> &x, vector<double> &y) {
+    const int N = system.constants.total_atoms;
+    aligned_vector x9;
+    if (!system.constants.polar_matrix_free) {
+        x9.resize(9*N);
+        for (int a=0; a<N; a++) tile_dipole(&x9[0], a, &x[3*a]);
+    }
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int a=0; a<N; a++) {
+        int p;
+        double field[3] = {0,0,0};
+        const double alpha = system.atoms.polar[a];
+        if (alpha == 0) {
+            for (p=0; p<3; p++) y[3*a+p] = 0;
+            continue;
+        }
+        if (system.constants.polar_matrix_free)
+            thole_contract_row(system, a, &x[0], field);
+        else
+            amatrix_contract(system, a, &x9[0], field);
+        for (p=0; p<3; p++)
+            y[3*a+p] = x[3*a+p]/alpha - field[p];
+    }
+}
+
+// group the polarizable atoms into preconditioner blocks and Cholesky-factor each
+// block of A (m x m, m = 3 x sites, row-major lower triangle in factor)
+void pcg_blocks(System &system, vector<int> &block_start, vector<int> &block_atoms, vector<int> &factor_start, vector<double> &factor) {
+    int i, a, m, n, u, v, k, p, q, sites;
+    double T[3][3], sum;
+
+    block_start.clear(); block_atoms.clear(); factor_start.clear(); factor.clear();
+    for (i=0; i<system.molecules.size(); i++) {
+        sites = 0;
+        for (a=system.atoms.start[i]; a<system.atoms.start[i+1]; a++)
+            if (system.atoms.polar[a] != 0) sites++;
+        for (a=system.atoms.start[i]; a<system.atoms.start[i+1]; a++) {
+            if (system.atoms.polar[a] == 0) continue;
+            // a new block for every site of a big molecule, one for the whole of a small one
+            if (sites > PCG_BLOCK_MAX || block_start.empty() || system.atoms.mol[block_atoms[block_start.back()]] != i)
+                block_start.push_back(block_atoms.size());
+            block_atoms.push_back(a);
+        }
+    }
+    block_start.push_back(block_atoms.size());
+
+    for (k=0; k+1<block_start.size(); k++) {
+        n = block_start[k+1] - block_start[k];
+        m = 3*n;
+        factor_start.push_back(factor.size());
+        factor.resize(factor.size() + m*m, 0.0);
+        double *L = &factor[factor_start[k]];
+        const int *atoms = &block_atoms[block_start[k]];
+
+        for (u=0; u<n; u++) {
+            for (p=0; p<3; p++) L[(3*u+p)*m + 3*u+p] = 1.0/system.atoms.polar[atoms[u]];
+            for (v=0; v<u; v++) {
+                thole_tensor(system, atoms[u], atoms[v], T);
+                for (p=0; p<3; p++)
+                    for (q=0; q<3; q++)
+                        L[(3*u+p)*m + 3*v+q] = T[p][q];
+            }
+        }
+
+        // in-place Cholesky; if the block is not positive definite keep only its diagonal
+        for (u=0; u<m; u++) {
+            for (v=0; v<=u; v++) {
+                sum = L[u*m+v];
+                for (p=0; p<v; p++) sum -= L[u*m+p]*L[v*m+p];
+                if (u == v) {
+                    if (sum <= 0) break;
+                    L[u*m+u] = sqrt(sum);
+                } else
+                    L[u*m+v] = sum/L[v*m+v];
+            }
+            if (v <= u) break;
+        }
+        if (u < m) {
+            for (u=0; u<m; u++)
+                for (v=0; v<=u; v++)
+                    L[u*m+v] = (u == v) ? sqrt(1.0/system.atoms.polar[atoms[u/3]]) : 0;
+        }
+    }
+}
+
+// z = M^-1 r, M the block diagonal of A
+void pcg_precondition(System &system, const vector<int> &block_start, const vector<int> &block_atoms, const vector<int> &factor_start, const vector<double> &factor, const vector<double> &r, vector<double> &z) {
+    #pragma omp parallel for schedule(dynamic, 16)
+    for (int k=0; k<(int)block_start.size()-1; k++) {
+        int u, p;
+        const int n = block_start[k+1] - block_start[k];
+        const int m = 3*n;
+        const double *L = &factor[factor_start[k]];
+        const int *atoms = &block_atoms[block_start[k]];
+        double w[3*PCG_BLOCK_MAX];
+        double sum;
+
+        // L w = r, then L^T z = w
+        for (u=0; u<m; u++) {
+            sum = r[3*atoms[u/3] + u%3];
+            for (p=0; p<u; p++) sum -= L[u*m+p]*w[p];
+            w[u] = sum/L[u*m+u];
+        }
+        for (u=m-1; u>=0; u--) {
+            sum = w[u];
+            for (p=u+1; p<m; p++) sum -= L[p*m+u]*w[p];
+            w[u] = sum/L[u*m+u];
+        }
+        for (u=0; u<m; u++) z[3*atoms[u/3] + u%3] = w[u];
+    }
+}
+
+double pcg_dot(const vector<double> &a, const vector<double> &b) {
+    double sum = 0;
+    for (int n=0; n<a.size(); n++) sum += a[n]*b[n];
+    return sum;
+}
+
+/* conjugate-gradient solver of the dipole field equations */
+/* returns the number of iterations (matrix-vector products) required */
+int thole_pcg(System &system) {
+    int a, p, n, ti, tj;
+    int iteration_counter = 0;
+    const int N = system.constants.total_atoms;
+    vector<double> x(3*N), rhs(3*N), r(3*N), z(3*N, 0.0), d(3*N), Ad(3*N);
+    vector<int> block_start, block_atoms, factor_start;
+    vector<double> factor;
+    double rz, rz_old, dAd, step, error, max_error;
+    // stop once no dipole would change by more than polar_precision in a Jacobi step (alpha * residual)
+    const double allowed_err = system.constants.polar_precision*system.constants.DEBYE2SKA;
+
+    init_dipoles(system);
+    for (a=0; a<N; a++) {
+        ti = system.atommap[a][0]; tj = system.atommap[a][1];
+        for (p=0; p<3; p++) {
+            x[3*a+p] = system.atoms.polar[a] != 0 ? system.molecules[ti].atoms[tj].dip[p] : 0;
+            rhs[3*a+p] = system.atoms.polar[a] != 0 ? system.molecules[ti].atoms[tj].efield[p] + system.molecules[ti].atoms[tj].efield_self[p] : 0;
+        }
+    }
+    pcg_blocks(system, block_start, block_atoms, factor_start, factor);
+
+    thole_matvec(system, x, Ad);
+    for (n=0; n<3*N; n++) r[n] = rhs[n] - Ad[n];
+    pcg_precondition(system, block_start, block_atoms, factor_start, factor, r, z);
+    d = z;
+    rz = pcg_dot(r, z);
+
+    while (1) {
+        if (system.constants.polar_precision > 0) {
+            max_error = 0;
+            for (n=0; n<3*N; n++) {
+                error = fabs(system.atoms.polar[n/3]*r[n]);
+                if (error > max_error) max_error = error;
+            }
+            if (max_error <= allowed_err) break;
+        } else if (iteration_counter == system.constants.polar_max_iter)
+            break;
+
+        /* divergence detection */
+        /* if we fail to converge, then return dipoles as alpha*E */
+        if (iteration_counter >= MAX_ITERATION_COUNT && system.constants.polar_precision) {
+            for (a=0; a<N; a++) {
+                ti = system.atommap[a][0]; tj = system.atommap[a][1];
+                for (p=0; p<3; p++) {
+                    system.molecules[ti].atoms[tj].dip[p] = system.molecules[ti].atoms[tj].polar * rhs[3*a+p];
+                    system.molecules[ti].atoms[tj].efield_induced_change[p] = 0.0; //so we don't break palmo
+                }
+            }
+            system.constants.iter_success = 1;
+            printf("POLAR CONVERGENCE FAILURE\n");
+            return iteration_counter;
+        }
+
+        iteration_counter++;
+        thole_matvec(system, d, Ad);
+        dAd = pcg_dot(d, Ad);
+        if (dAd <= 0) break; // zero residual (or a breakdown): nothing more to gain
+        step = rz/dAd;
+        for (n=0; n<3*N; n++) {
+            x[n] += step*d[n];
+            r[n] -= step*Ad[n];
+        }
+        pcg_precondition(system, block_start, block_atoms, factor_start, factor, r, z);
+        rz_old = rz;
+        rz = pcg_dot(r, z);
+        for (n=0; n<3*N; n++) d[n] = z[n] + (rz/rz_old)*d[n];
+    }
+
+    // hand the solution back in the form the sweeps leave it: mu = alpha (E + E_induced), and
+    // the palmo field change E - A mu (the residual) for the energy correction
+    for (a=0; a<N; a++) {
+        ti = system.atommap[a][0]; tj = system.atommap[a][1];
+        Atom &atom = system.molecules[ti].atoms[tj];
+        for (p=0; p<3; p++) {
+            atom.dip[p] = atom.newdip[p] = x[3*a+p];
+            atom.efield_induced[p] = atom.polar != 0 ? x[3*a+p]/atom.polar - rhs[3*a+p] : 0;
+            atom.efield_induced_change[p] = r[3*a+p];
+        }
+    }
+
+    return iteration_counter;
+}
@@ -2,6 +2,10 @@
 #define _USE_MATH_DEFINES
 #include <math.h>
 #include <stdlib.h>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 double dddotprod( double * a, double * b ) {
     return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
@@ -11,14 +15,76 @@ double iidotprod( int * a, int * b) {
     return a[0]*b[0] + a[1]*b[1] + a[2]*b[2];
 }
 
-double * crossprod( double * a, double * b) {
-    static double output[3];
-
+void crossprod( double * a, double * b, double * output) {
     output[0] = a[1]*b[2] - a[2]*b[1];
     output[1] = a[2]*b[0] - a[0]*b[2];
     output[2] = a[0]*b[1] - a[1]*b[0];
+}
+
+// OpenMP thread bookkeeping that also works when built without -fopenmp.
+// threadCount() is the team size a parallel region will get; threadId() is 0 outside of one.
+int threadCount() {
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+int threadId() {
+#ifdef _OPENMP
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+// the calling thread's contiguous share [*first, *last) of n items inside a parallel region
+void threadBlock(int n, int *first, int *last) {
+#ifdef _OPENMP
+    const int nt = omp_get_num_threads(), t = omp_get_thread_num();
+#else
+    const int nt = 1, t = 0;
+#endif
+    *first = (int)((long)n*t/nt);
+    *last = (int)((long)n*(t+1)/nt);
+}
+
+// sum per-thread partial results in thread order, so a run with a given
+// number of threads always adds things up the same way
+double sumThreads(const std::vector<double> &part) {
+    double sum = 0;
+    for (int t=0; t<part.size(); t++) sum += part[t];
+    return sum;
+}
+
+// unit quaternions q = (w, x, y, z), for rigid-body orientations
+// out = a b, i.e. rotate by b and then by a
+void quatMultiply(const double *a, const double *b, double *out) {
+    const double w = a[0]*b[0] - a[1]*b[1] - a[2]*b[2] - a[3]*b[3];
+    const double x = a[0]*b[1] + a[1]*b[0] + a[2]*b[3] - a[3]*b[2];
+    const double y = a[0]*b[2] - a[1]*b[3] + a[2]*b[0] + a[3]*b[1];
+    const double z = a[0]*b[3] + a[1]*b[2] - a[2]*b[1] + a[3]*b[0];
+    out[0] = w; out[1] = x; out[2] = y; out[3] = z;
+}
+
+void quatNormalize(double *q) {
+    const double n = 1.0/sqrt(q[0]*q[0] + q[1]*q[1] + q[2]*q[2] + q[3]*q[3]);
+    for (int p=0; p<4; p++) q[p] *= n;
+}
+
+// rotation by angle (rad, right-handed) about the unit vector u
+void quatAxisAngle(const double *u, double angle, double *q) {
+    const double s = sin(0.5*angle);
+    q[0] = cos(0.5*angle); q[1] = u[0]*s; q[2] = u[1]*s; q[3] = u[2]*s;
+}
 
-    return output;
+// the 3x3 rotation matrix of q: r' = R r
+void quatMatrix(const double *q, double R[3][3]) {
+    const double w = q[0], x = q[1], y = q[2], z = q[3];
+    R[0][0] = 1 - 2*(y*y + z*z); R[0][1] = 2*(x*y - w*z);     R[0][2] = 2*(x*z + w*y);
+    R[1][0] = 2*(x*y + w*z);     R[1][1] = 1 - 2*(x*x + z*z); R[1][2] = 2*(y*z - w*x);
+    R[2][0] = 2*(x*z - w*y);     R[2][1] = 2*(y*z + w*x);     R[2][2] = 1 - 2*(x*x + y*y);
 }
 
 // custom erf^-1(x)